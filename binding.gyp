@@ -1,18 +1,29 @@
 {
+  "variables": {
+    # FUSE 2 unless libfuse 3 is asked for with F4JS_FUSE3=1 in the
+    # environment or -Dfuse_pkg=fuse3, since it rejects some FUSE 2 mount
+    # options
+    "fuse_pkg%": '<!(test "$F4JS_FUSE3" = 1 && echo fuse3 || echo fuse)',
+  },
   "targets": [
         {
           "target_name": "fuse4js",
-          "sources": [ "fuse4js.cc" ],
+          "sources": [ "fuse4js.cc", "memfs.cc", "manifest.cc", "blockcache.cc" ],
           "include_dirs": [
-             '<!@(pkg-config fuse --cflags-only-I | sed s/-I//g)',
+             '<!@(pkg-config <(fuse_pkg) --cflags-only-I | sed s/-I//g)',
              "<!(node -e \"require('nan')\")",
           ],
           "link_settings": {
             "libraries": [
-              '<!@(pkg-config --libs-only-l fuse)',
+              '<!@(pkg-config --libs-only-l <(fuse_pkg))',
               "-L/usr/local/lib"
             ]
-          }
+          },
+          "conditions": [
+            [ 'fuse_pkg=="fuse3"', {
+              "defines": [ "F4JS_FUSE3" ]
+            }]
+          ]
         }
       ]
 }
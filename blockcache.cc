@@ -0,0 +1,380 @@
+/*
+ *
+ * blockcache.cc
+ *
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ *
+ */
+
+#include "blockcache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+
+#define BLOCKCACHE_MAGIC "F4JSBLK2"
+
+// Upper bound on the number of remembered version tokens
+#define BLOCKCACHE_MAX_VERSIONS 65536
+
+/*
+ * Block files are named <16 hex digit hash of path and version>-<block>, so
+ * all blocks of one version of a file form a contiguous range of 'index'.
+ * Each file starts with the magic, the key length, the data length and the
+ * key, followed by the data.
+ */
+struct blockcache_block_t {
+  uint64_t size;                       // bytes on disk
+  std::list<std::string>::iterator lru;
+};
+
+struct blockcache_version_t {
+  std::string token;
+  std::list<std::string>::iterator age;
+};
+
+static struct {
+  bool enabled;
+  std::string dir;
+  uint64_t maxBytes;
+  std::map<std::string, blockcache_block_t> index;  // file name -> block
+  std::list<std::string> lru;                       // most recently used first
+  std::map<std::string, blockcache_version_t> versions; // path -> version token
+  std::list<std::string> versionOrder;              // paths, least recently set first
+  blockcache_stats_t stats;
+} blockcache;
+
+// Taken by the FUSE thread for every operation, and by blockcache_stats()
+static pthread_mutex_t blockcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+class BlockCacheLock {
+public:
+  BlockCacheLock() { pthread_mutex_lock(&blockcache_mutex); }
+  ~BlockCacheLock() { pthread_mutex_unlock(&blockcache_mutex); }
+};
+
+// ---------------------------------------------------------------------------
+
+static std::string blockcache_key(const char *path, const std::string &version)
+{
+  return std::string(path) + '\0' + version;
+}
+
+// ---------------------------------------------------------------------------
+
+// FNV-1a
+static std::string blockcache_hash(const std::string &key)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key.size(); i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+  return hex;
+}
+
+// ---------------------------------------------------------------------------
+
+static std::string blockcache_name(const std::string &hash, uint64_t block)
+{
+  char suffix[24];
+  snprintf(suffix, sizeof(suffix), "-%llu", (unsigned long long)block);
+  return hash + suffix;
+}
+
+// ---------------------------------------------------------------------------
+
+static void blockcache_remove(std::map<std::string, blockcache_block_t>::iterator it)
+{
+  unlink((blockcache.dir + "/" + it->first).c_str());
+  blockcache.stats.blocks--;
+  blockcache.stats.bytes -= it->second.size;
+  blockcache.lru.erase(it->second.lru);
+  blockcache.index.erase(it);
+}
+
+// ---------------------------------------------------------------------------
+
+static void blockcache_evict()
+{
+  while (blockcache.stats.bytes > blockcache.maxBytes && !blockcache.lru.empty()) {
+    blockcache_remove(blockcache.index.find(blockcache.lru.back()));
+    blockcache.stats.evictions++;
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+static void blockcache_add(const std::string &name, uint64_t size)
+{
+  blockcache_block_t &entry = blockcache.index[name];
+  blockcache.lru.push_front(name);
+  entry.size = size;
+  entry.lru = blockcache.lru.begin();
+  blockcache.stats.blocks++;
+  blockcache.stats.bytes += size;
+}
+
+// ---------------------------------------------------------------------------
+
+static bool blockcache_valid_name(const char *name)
+{
+  size_t len = strlen(name);
+  if (len < 18 || name[16] != '-')
+    return false;
+  for (size_t i = 0; i < len; i++) {
+    if (i != 16 && !isxdigit((unsigned char)name[i]))
+      return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+
+bool blockcache_open(const char *dir, uint64_t maxBytes, std::string *error)
+{
+  BlockCacheLock lock;
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+    *error = std::string("cannot create block cache directory: ") + strerror(errno);
+    return false;
+  }
+  DIR *d = opendir(dir);
+  if (d == NULL) {
+    *error = std::string("cannot open block cache directory: ") + strerror(errno);
+    return false;
+  }
+
+  blockcache.dir = dir;
+  blockcache.maxBytes = maxBytes;
+  blockcache.index.clear();
+  blockcache.lru.clear();
+  blockcache.versions.clear();
+  blockcache.versionOrder.clear();
+  memset(&blockcache.stats, 0, sizeof(blockcache.stats));
+
+  // Rebuild the index from the previous run, oldest blocks first
+  std::vector<std::pair<time_t, std::pair<std::string, uint64_t> > > found;
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL) {
+    std::string path = blockcache.dir + "/" + de->d_name;
+    struct stat st;
+    if (de->d_name[0] == '.' || lstat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+      continue;
+    if (!blockcache_valid_name(de->d_name)) {
+      if (strstr(de->d_name, ".tmp"))
+        unlink(path.c_str()); // left over from an interrupted write
+      continue;
+    }
+    found.push_back(std::make_pair(st.st_mtime,
+                                   std::make_pair(std::string(de->d_name), (uint64_t)st.st_size)));
+  }
+  closedir(d);
+
+  std::sort(found.begin(), found.end());
+  for (size_t i = 0; i < found.size(); i++)
+    blockcache_add(found[i].second.first, found[i].second.second);
+  blockcache_evict();
+
+  blockcache.enabled = true;
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+
+bool blockcache_enabled()
+{
+  return blockcache.enabled;
+}
+
+// ---------------------------------------------------------------------------
+
+static void blockcache_forget(std::map<std::string, blockcache_version_t>::iterator v)
+{
+  blockcache.versionOrder.erase(v->second.age);
+  blockcache.versions.erase(v);
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * When there are too many tokens, the one set longest ago is forgotten.
+ * Its blocks stay, and are found again if the next getattr() of that path
+ * returns the same version.
+ */
+void blockcache_set_version(const char *path, const std::string &version)
+{
+  BlockCacheLock lock;
+  std::map<std::string, blockcache_version_t>::iterator v = blockcache.versions.find(path);
+  if (v != blockcache.versions.end()) {
+    v->second.token = version;
+    blockcache.versionOrder.splice(blockcache.versionOrder.end(), blockcache.versionOrder,
+                                   v->second.age);
+    return;
+  }
+  if (blockcache.versions.size() >= BLOCKCACHE_MAX_VERSIONS)
+    blockcache_forget(blockcache.versions.find(blockcache.versionOrder.front()));
+  blockcache_version_t &entry = blockcache.versions[path];
+  entry.token = version;
+  entry.age = blockcache.versionOrder.insert(blockcache.versionOrder.end(), path);
+}
+
+// ---------------------------------------------------------------------------
+
+bool blockcache_has_version(const char *path)
+{
+  if (!blockcache.enabled)
+    return false; // called on every read
+  BlockCacheLock lock;
+  return blockcache.versions.count(path) > 0;
+}
+
+// ---------------------------------------------------------------------------
+
+// Delete the blocks of one version of a file
+static void blockcache_drop_blocks(const std::string &path, const std::string &version)
+{
+  std::string prefix = blockcache_hash(blockcache_key(path.c_str(), version)) + "-";
+  std::map<std::string, blockcache_block_t>::iterator it = blockcache.index.lower_bound(prefix);
+  while (it != blockcache.index.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+    blockcache_remove(it++);
+}
+
+// ---------------------------------------------------------------------------
+
+void blockcache_invalidate(const char *path, bool subtree)
+{
+  if (!blockcache.enabled)
+    return;
+  BlockCacheLock lock;
+  std::map<std::string, blockcache_version_t>::iterator v = blockcache.versions.find(path);
+  if (v != blockcache.versions.end()) {
+    blockcache_drop_blocks(v->first, v->second.token);
+    blockcache_forget(v);
+  }
+  if (subtree) {
+    // Once the versions are forgotten, their blocks could not be found again
+    std::string prefix = std::string(path) + "/";
+    v = blockcache.versions.lower_bound(prefix);
+    while (v != blockcache.versions.end() && v->first.compare(0, prefix.size(), prefix) == 0) {
+      blockcache_drop_blocks(v->first, v->second.token);
+      blockcache_forget(v++);
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+ssize_t blockcache_get(const char *path, uint64_t block, char *buf)
+{
+  BlockCacheLock lock;
+  std::map<std::string, blockcache_version_t>::iterator v = blockcache.versions.find(path);
+  if (v == blockcache.versions.end())
+    return -1;
+  std::string key = blockcache_key(path, v->second.token);
+  std::string name = blockcache_name(blockcache_hash(key), block);
+  std::map<std::string, blockcache_block_t>::iterator it = blockcache.index.find(name);
+  if (it == blockcache.index.end()) {
+    blockcache.stats.misses++;
+    return -1;
+  }
+
+  std::string file = blockcache.dir + "/" + name;
+  int fd = open(file.c_str(), O_RDONLY);
+  ssize_t n = -1;
+  if (fd >= 0) {
+    size_t headerLen = 8 + 2 * sizeof(uint32_t) + key.size();
+    std::vector<char> header(headerLen);
+    uint32_t keyLen, dataLen;
+    if (pread(fd, &header[0], headerLen, 0) == (ssize_t)headerLen &&
+        memcmp(&header[0], BLOCKCACHE_MAGIC, 8) == 0 &&
+        (memcpy(&keyLen, &header[8], sizeof(keyLen)), keyLen == key.size()) &&
+        (memcpy(&dataLen, &header[8 + sizeof(keyLen)], sizeof(dataLen)),
+         dataLen <= BLOCKCACHE_BLOCK_SIZE) &&
+        memcmp(&header[8 + 2 * sizeof(uint32_t)], key.data(), key.size()) == 0 &&
+        pread(fd, buf, dataLen, headerLen) == (ssize_t)dataLen) {
+      n = dataLen;
+    }
+    close(fd);
+  }
+  if (n < 0) {
+    blockcache_remove(it); // unreadable, truncated, or a hash collision
+    blockcache.stats.misses++;
+    return -1;
+  }
+
+  blockcache.lru.splice(blockcache.lru.begin(), blockcache.lru, it->second.lru);
+  utimes(file.c_str(), NULL); // remember the recency across remounts
+  blockcache.stats.hits++;
+  return n;
+}
+
+// ---------------------------------------------------------------------------
+
+void blockcache_put(const char *path, uint64_t block, const char *data, size_t len)
+{
+  BlockCacheLock lock;
+  std::map<std::string, blockcache_version_t>::iterator v = blockcache.versions.find(path);
+  if (v == blockcache.versions.end())
+    return;
+  std::string key = blockcache_key(path, v->second.token);
+  std::string name = blockcache_name(blockcache_hash(key), block);
+  std::string file = blockcache.dir + "/" + name;
+  std::string tmp = file + ".tmp";
+
+  std::string header(BLOCKCACHE_MAGIC);
+  uint32_t keyLen = key.size();
+  uint32_t dataLen = len;
+  header.append((const char*)&keyLen, sizeof(keyLen));
+  header.append((const char*)&dataLen, sizeof(dataLen));
+  header.append(key);
+
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+    return;
+  bool ok = write(fd, header.data(), header.size()) == (ssize_t)header.size() &&
+            write(fd, data, len) == (ssize_t)len;
+  close(fd);
+  // The rename keeps readers from seeing a half written block. There is no
+  // fsync, so after a crash the data may still be short; blockcache_get()
+  // catches that from the length in the header.
+  if (!ok || rename(tmp.c_str(), file.c_str()) < 0) {
+    unlink(tmp.c_str());
+    return;
+  }
+
+  std::map<std::string, blockcache_block_t>::iterator it = blockcache.index.find(name);
+  if (it != blockcache.index.end()) {
+    blockcache.stats.blocks--;
+    blockcache.stats.bytes -= it->second.size;
+    blockcache.lru.erase(it->second.lru);
+    blockcache.index.erase(it);
+  }
+  blockcache_add(name, header.size() + len);
+  blockcache_evict();
+}
+
+// ---------------------------------------------------------------------------
+
+void blockcache_stats(blockcache_stats_t *stats)
+{
+  BlockCacheLock lock;
+  *stats = blockcache.stats;
+}
@@ -0,0 +1,63 @@
+/*
+ *
+ * blockcache.h
+ *
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ *
+ */
+
+/*
+ * Local on-disk cache of file data returned by the read() handler.
+ *
+ * Data is cached in blocks of BLOCKCACHE_BLOCK_SIZE bytes, one file per
+ * block, keyed by the path, a version token and the block number. The
+ * version token comes from the last getattr() of the path, so a file that
+ * changes on the backend gets new keys, and its stale blocks eventually
+ * age out. Blocks are evicted in least recently used order once the cache
+ * exceeds its size limit. The cache directory is rescanned at startup, so
+ * the cache survives remounts.
+ *
+ * Reading a block back verifies the full key and the data length stored in
+ * its header, so hash collisions and blocks truncated by a crash are treated
+ * as misses.
+ */
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+
+#define BLOCKCACHE_BLOCK_SIZE (128 * 1024)
+
+struct blockcache_stats_t {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  uint64_t blocks;
+  uint64_t bytes;
+};
+
+// Use 'dir' for the cache, creating it if needed. Returns false and sets
+// 'error' on failure.
+bool blockcache_open(const char *dir, uint64_t maxBytes, std::string *error);
+bool blockcache_enabled();
+
+// Record the version token returned by getattr() for a path
+void blockcache_set_version(const char *path, const std::string &version);
+bool blockcache_has_version(const char *path);
+
+// The contents of 'path' (or of everything below it) changed through the
+// file system: drop its blocks and bypass the cache until the next getattr()
+void blockcache_invalidate(const char *path, bool subtree);
+
+// Returns the number of bytes in the block, or -1 on a miss
+ssize_t blockcache_get(const char *path, uint64_t block, char *buf);
+void blockcache_put(const char *path, uint64_t block, const char *data, size_t len);
+
+void blockcache_stats(blockcache_stats_t *stats);
+
+#endif
@@ -383,19 +383,58 @@ function init(cb) {
  * Darwin(Mac OSX):
  *  * a = position
  *  * b = options
- *  * c = cmd
+ *  * c = cb, a callback of the form cb(err)
  * Other:
  *  * a = flags
- *  * b = cmd
+ *  * b = cb, a callback of the form cb(err)
  *  * c = undefined
  */
 function setxattr(path, name, value, size, a, b, c) {
   console.log("Setxattr called:", path, name, value, size, a, b, c)
+  var cb = (typeof c === 'function')? c : b;
   cb(0);
 }
 
 //---------------------------------------------------------------------------
 
+/*
+ * Handler for the getxattr() FUSE hook.
+ * path: the path to the file
+ * name: the name of the extended attribute
+ * cb: a callback of the form cb(err, value), where err is the Posix return code
+ *     and value is the attribute value as a Buffer or string (when err === 0).
+ *     The whole value must be returned; fuse4js takes care of size queries.
+ */
+function getxattr(path, name, cb) {
+  cb(-61); // -ENODATA: we don't store extended attributes
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for the listxattr() FUSE hook.
+ * path: the path to the file
+ * cb: a callback of the form cb(err, names), where err is the Posix return code
+ *     and names is an array of attribute names (when err === 0).
+ */
+function listxattr(path, cb) {
+  cb(0, []);
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for the removexattr() FUSE hook.
+ * path: the path to the file
+ * name: the name of the extended attribute
+ * cb: a callback of the form cb(err), where err is the Posix return code.
+ */
+function removexattr(path, name, cb) {
+  cb(-61); // -ENODATA
+}
+
+//---------------------------------------------------------------------------
+
 /*
  * Handler for the statfs() FUSE hook. 
  * cb: a callback of the form cb(err, stat), where err is the Posix return code
@@ -452,6 +491,9 @@ var handlers = {
   init: init,
   destroy: destroy,
   setxattr: setxattr,
+  getxattr: getxattr,
+  listxattr: listxattr,
+  removexattr: removexattr,
   statfs: statfs
 };
 
@@ -0,0 +1,147 @@
+/*
+ * 
+ * memFS.js
+ * 
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ * 
+ */
+var f4js = require('fuse4js');
+var fs = require('fs');
+var options = {};  // See parseArgs()
+
+/*
+ * Same as jsonFS.js, but the file system is served by the native in-memory
+ * engine instead of Javascript handlers. Operations without a handler are
+ * handled on the FUSE thread. A handler for any other operation takes it
+ * over from the engine, like statfs() below. Handlers for open(), create(),
+ * read(), write() and release() take over all five, because the engine's
+ * file handles are only meaningful to the engine.
+ */
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for the init() FUSE hook. You can initialize your file system here.
+ * cb: a callback to call when you're done initializing. It takes no arguments.
+ */
+function init(cb) {
+  console.log("File system started at " + options.mountPoint);
+  console.log("To stop it, type this in another shell: fusermount -u " + options.mountPoint);
+  cb();
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for the destroy() FUSE hook. You can perform clean up tasks here.
+ * cb: a callback to call when you're done. It takes no arguments.
+ */
+function destroy(cb) {
+  if (options.outJson) {
+    try {
+      fs.writeFileSync(options.outJson, f4js.snapshot(), 'utf8');
+    } catch (e) {
+      console.log("Exception when writing file: " + e);
+    }
+  }
+  console.log("File system stopped");      
+  cb();
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for the statfs() FUSE hook, overriding the engine's answer to
+ * advertise a fixed capacity of 1GB.
+ * cb: a callback of the form cb(err, stat), where err is the Posix return code
+ *     and stat is the result in the form of a statvfs structure (when err === 0)
+ */
+function statfs(cb) {
+  cb(0, {
+      bsize: 65536,
+      frsize: 65536,
+      blocks: 16384,
+      bfree: 16384,
+      bavail: 16384,
+      files: 1000000,
+      ffree: 1000000,
+      favail: 1000000,
+      namemax: 255
+  });
+}
+
+//---------------------------------------------------------------------------
+
+var handlers = {
+  init: init,
+  destroy: destroy,
+  statfs: statfs
+};
+
+//---------------------------------------------------------------------------
+
+function usage() {
+  console.log();
+  console.log("Usage: node memFS.js [options] [inputJsonFile] mountPoint");
+  console.log("(Ensure the mount point is empty and you have wrx permissions to it)\n")
+  console.log("Options:");
+  console.log("-o outputJsonFile  : save the file system contents to a JSON file when unmounted.");
+  console.log("-d                 : make FUSE print debug statements.");
+  console.log();
+  console.log("Example:");
+  console.log("node example/memFS.js -o /tmp/output.json example/sample.json /tmp/mnt");
+  console.log();
+}
+
+//---------------------------------------------------------------------------
+
+function parseArgs() {
+  var i;
+  var args = process.argv;
+  if (args.length < 3) {
+    return false;
+  }
+  options.mountPoint = args[args.length - 1];
+  i = 2;
+  while (i < args.length - 1) {
+    if (args[i] === '-d') {
+      options.debugFuse = true;
+      ++i;
+    } else if (args[i] === '-o') {
+      if (i + 2 < args.length) {
+        options.outJson = args[i+1];
+        i += 2;
+      } else return false;
+    } else if (i === args.length - 2) {
+      options.inJson = args[i];
+      ++i;
+    } else return false;
+  }
+  return true;
+}
+
+//---------------------------------------------------------------------------
+
+(function main() {
+  if (parseArgs()) {
+    var contents = true; // start with an empty file system
+    if (options.inJson) {
+      console.log("\nInput file: " + options.inJson);
+      contents = JSON.parse(fs.readFileSync(options.inJson, 'utf8'));
+    }
+    console.log("Mount point: " + options.mountPoint);
+    if (options.outJson)
+      console.log("Output file: " + options.outJson);
+    if (options.debugFuse)
+      console.log("FUSE debugging enabled");
+    try {
+      f4js.start(options.mountPoint, handlers, options.debugFuse, [], { inMemory: contents });
+    } catch (e) {
+      console.log("Exception when starting file system: " + e);
+    }
+  } else {
+    usage();
+  }
+})();
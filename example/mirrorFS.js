@@ -30,7 +30,8 @@ var errnoMap = {
     ENOENT: 2,
     EACCES: 13,    
     EINVAL: 22,
-    ENOTEMPTY: 39
+    ENOTEMPTY: 39,
+    EOPNOTSUPP: 95
 };
 
 function excToErrno(exc) {
@@ -46,7 +47,10 @@ function excToErrno(exc) {
  * Handler for the getattr() system call.
  * path: the path to the file
  * cb: a callback of the form cb(err, stat), where err is the Posix return code
- *     and stat is the result in the form of a stat structure (when err === 0)
+ *     and stat is the result in the form of a stat structure (when err === 0).
+ *     stat may also have a 'version' string or number that changes whenever
+ *     the file's contents do; the blockCache option uses it, or else mtime
+ *     and size, to tell whether cached data is still current.
  */
 function getattr(path, cb) {	  
   var path = pth.join(srcRoot, path);
@@ -133,7 +137,13 @@ function convertOpenFlags(openFlags) {
  * flags: requested access flags as documented in open(2)
  * cb: a callback of the form cb(err, [fh]), where err is the Posix return code
  *     and fh is an optional numerical file handle, which is passed to subsequent
- *     read(), write(), and release() calls (set to 0 if fh is unspecified)
+ *     read(), write(), and release() calls (set to 0 if fh is unspecified).
+ *     Instead of a number, fh can be an object with these optional properties:
+ *       fh:          the numerical file handle
+ *       keep_cache:  true to keep the kernel's cached data for this file,
+ *                    e.g. when its contents are immutable
+ *       direct_io:   true to bypass the page cache for this open file
+ *       nonseekable: true if the file does not support seeking
  */
 function open(path, flags, cb) {
   var path = pth.join(srcRoot, path);
@@ -209,7 +219,8 @@ function release(path, fh, cb) {
  * mode: the desired permissions of the new file
  * cb: a callback of the form cb(err, [fh]), where err is the Posix return code
  *     and fh is an optional numerical file handle, which is passed to subsequent
- *     read(), write(), and release() calls (it's set to 0 if fh is unspecified)
+ *     read(), write(), and release() calls (it's set to 0 if fh is unspecified).
+ *     As with open(), fh can also be an object with cache control flags.
  */
 function create (path, mode, cb) {
   var path = pth.join(srcRoot, path);
@@ -222,6 +233,152 @@ function create (path, mode, cb) {
 
 //---------------------------------------------------------------------------
 
+// Largest buffer copy_file_range() allocates at a time
+var COPY_CHUNK_SIZE = 1024 * 1024;
+
+/*
+ * Handler for the copy_file_range() system call. Only called when fuse4js
+ * is built against libfuse 3.4 or later; without this handler, the kernel
+ * copies the data with read() and write() calls instead.
+ * pathIn: the path of the source file
+ * fhIn: the file handle of the source file returned by open()
+ * offsetIn: the offset to copy from
+ * pathOut: the path of the destination file
+ * fhOut: the file handle of the destination file returned by open() or create()
+ * offsetOut: the offset to copy to
+ * len: the number of bytes to copy
+ * cb: a callback of the form cb(err), where err is the Posix return code.
+ *     A positive value represents the number of bytes actually copied; the
+ *     kernel asks again for the rest, so it may be less than len.
+ */
+function copy_file_range(pathIn, fhIn, offsetIn, pathOut, fhOut, offsetOut, len, cb) {
+  var buf = new Buffer(Math.min(len, COPY_CHUNK_SIZE));
+  var copied = 0;
+
+  function copyChunk() {
+    var n = Math.min(len - copied, buf.length);
+    if (n === 0)
+      return cb(copied);
+    fs.read(fhIn, buf, 0, n, offsetIn + copied, function readCb(err, bytesRead) {
+      if (err)
+        return cb(copied? copied : -excToErrno(err));
+      if (bytesRead === 0)
+        return cb(copied); // end of the source file
+      fs.write(fhOut, buf, 0, bytesRead, offsetOut + copied, function writeCb(err, bytesWritten) {
+        if (err)
+          return cb(copied? copied : -excToErrno(err));
+        copied += bytesWritten;
+        if (bytesWritten < bytesRead)
+          return cb(copied);
+        copyChunk();
+      });
+    });
+  }
+  copyChunk();
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for fstat() and other getattr() calls on an open file. Optional;
+ * without it, getattr() is called instead.
+ * path: the path to the file
+ * fh: the file handle returned by open() or create()
+ * cb: a callback of the form cb(err, stat), as for getattr()
+ */
+function fgetattr(path, fh, cb) {
+  fs.fstat(fh, function fstatCb(err, stats) {
+    if (err)
+      return cb(-excToErrno(err));
+    cb(0, stats);
+  });
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for the ftruncate() system call. Optional; without it, truncate()
+ * is called instead.
+ * path: the path to the file
+ * size: the new size of the file
+ * fh: the file handle returned by open() or create()
+ * cb: a callback of the form cb(err), where err is the Posix return code.
+ */
+function ftruncate(path, size, fh, cb) {
+  fs.ftruncate(fh, size, function ftruncateCb(err) {
+    if (err)
+      return cb(-excToErrno(err));
+    cb(0);
+  });
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for flush(), called on each close() of a file descriptor, before
+ * the final release(). Optional. Errors are reported to close().
+ * path: the path to the file
+ * fh: the file handle returned by open() or create()
+ * cb: a callback of the form cb(err), where err is the Posix return code.
+ *
+ * Registering it costs a round trip to Javascript on every close(), even
+ * with the asyncRelease option, so mirrorFS leaves it out of its handlers:
+ * writes go straight to the source file and there is nothing to flush.
+ */
+function flush(path, fh, cb) {
+  cb(0);
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for the fsync() and fdatasync() system calls. Optional; without
+ * it, they succeed without calling Javascript.
+ * path: the path to the file
+ * datasync: true for fdatasync(), which need not flush metadata
+ * fh: the file handle returned by open() or create()
+ * cb: a callback of the form cb(err), where err is the Posix return code.
+ */
+function fsync(path, datasync, fh, cb) {
+  var sync = datasync? fs.fdatasync : fs.fsync;
+  sync(fh, function fsyncCb(err) {
+    if (err)
+      return cb(-excToErrno(err));
+    cb(0);
+  });
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Handler for the fallocate() system call. Optional; only called when the
+ * add-on is built against libfuse 2.9 or later.
+ * path: the path to the file
+ * mode: the mode flags documented in fallocate(2), 0 to allocate and extend
+ * offset: the start of the range
+ * len: the length of the range
+ * fh: the file handle returned by open() or create()
+ * cb: a callback of the form cb(err), where err is the Posix return code.
+ */
+function fallocate(path, mode, offset, len, fh, cb) {
+  if (mode !== 0)
+    return cb(-errnoMap.EOPNOTSUPP);
+  // node.js has no fallocate(), so just extend the file to cover the range
+  fs.fstat(fh, function fstatCb(err, stats) {
+    if (err)
+      return cb(-excToErrno(err));
+    if (stats.size >= offset + len)
+      return cb(0);
+    fs.ftruncate(fh, offset + len, function ftruncateCb(err) {
+      if (err)
+        return cb(-excToErrno(err));
+      cb(0);
+    });
+  });
+}
+
+//---------------------------------------------------------------------------
+
 /*
  * Handler for the unlink() system call.
  * path: the path to the file
@@ -353,6 +510,11 @@ var handlers = {
   write: write,
   release: release,
   create: create,
+  copy_file_range: copy_file_range,
+  fgetattr: fgetattr,
+  ftruncate: ftruncate,
+  fsync: fsync,
+  fallocate: fallocate,
   unlink: unlink,
   rename: rename,
   mkdir: mkdir,
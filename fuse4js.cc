@@ -21,13 +21,11 @@ using v8::Handle;
 using v8::Object;
 using v8::String;
 
-#define FUSE_USE_VERSION 26
-
 #ifdef HAVE_CONFIG_H
 #include <config.h>
 #endif
 
-#include <fuse.h>
+#include "fuse_compat.h"
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -40,25 +38,56 @@ using v8::String;
 #endif
 
 #include <fuse.h>
+#include "memfs.h"
+#include "manifest.h"
+#include "blockcache.h"
 #include <semaphore.h>
 #include <string>
 #include <iostream>
 #include <sstream>
+#include <map>
+#include <set>
+#include <deque>
+#include <pthread.h>
 #include <stdlib.h>
+#include <time.h>
 
 using namespace v8;
 
 // ---------------------------------------------------------------------------
 
+#ifndef ENOATTR
+#define ENOATTR ENODATA
+#endif
+
+/*
+ * A cached getxattr() or listxattr() result. Keys are the path followed by
+ * a NUL and the attribute name; the attribute list is stored under the path
+ * followed by a NUL alone, since attribute names cannot be empty.
+ */
+struct f4js_xattr_t {
+  double expires;
+  int retval;         // 0 or -ENOATTR
+  std::string value;  // attribute value, or NUL separated names
+};
+
+// Upper bound on the number of cached extended attribute results
+#define F4JS_XATTR_CACHE_MAX_ENTRIES 65536
+
+// Expiration time and key of each cache insertion, oldest first
+typedef std::deque<std::pair<double, std::string> > f4js_cache_order_t;
+
+// ---------------------------------------------------------------------------
+
 static struct {
   bool enableFuseDebug;
+  bool inMemory;        // serve operations from the native memfs engine
   char **extraArgv;
   size_t extraArgc;
   uv_async_t async;
   sem_t *psem;
   pthread_t fuse_thread;
   std::string root;
-  Persistent<Object> handlers;
   Persistent<Object> nodeBuffer;
   Persistent<Function> GetAttrFunc;
   Persistent<Function> ReadDirFunc;
@@ -67,9 +96,28 @@ static struct {
   Persistent<Function> OpenCreateFunc;
   Persistent<Function> ReadFunc;
   Persistent<Function> WriteFunc;
+  Persistent<Function> XattrFunc;
+  Persistent<Function> NotifyFunc;
   Persistent<Function> GenericFunc;
+  bool asyncRelease;    // don't wait for the release handler
+  double negativeTimeout;                      // seconds, 0 disables the cache
+  std::map<std::string, double> negativeCache; // path -> expiration time
+  f4js_cache_order_t negativeOrder;
+  std::set<std::string> manifestShadowed;      // paths the manifest no longer describes
+  std::set<std::string> manifestShadowedTrees; // same, including everything below
+  double xattrTimeout;                         // seconds, 0 disables the cache
+  std::map<std::string, struct f4js_xattr_t> xattrCache;
+  f4js_cache_order_t xattrOrder;
 } f4js;
 
+// Upper bound on the number of cached ENOENT results
+#define F4JS_NEGATIVE_CACHE_MAX_ENTRIES 65536
+
+#define F4JS_DEFAULT_BLOCK_CACHE_SIZE (1024ULL * 1024 * 1024)
+
+// Upper bound on the length passed to the copy_file_range handler
+#define F4JS_MAX_COPY_SIZE (16 * 1024 * 1024)
+
 enum fuseop_t {  
   OP_GETATTR = 0,
   OP_TRUNCATE,
@@ -77,6 +125,9 @@ enum fuseop_t {
   OP_READLINK,
   OP_CHMOD,
   OP_SETXATTR,
+  OP_GETXATTR,
+  OP_LISTXATTR,
+  OP_REMOVEXATTR,
   OP_STATFS,
   OP_OPEN,
   OP_READ,
@@ -87,8 +138,15 @@ enum fuseop_t {
   OP_RENAME,
   OP_MKDIR,
   OP_RMDIR,
+  OP_COPY_FILE_RANGE,
+  OP_FGETATTR,
+  OP_FTRUNCATE,
+  OP_FLUSH,
+  OP_FSYNC,
+  OP_FALLOCATE,
   OP_INIT,
-  OP_DESTROY
+  OP_DESTROY,
+  OP_COUNT  // must be last
 };
 
 const char* fuseop_names[] = {
@@ -98,6 +156,9 @@ const char* fuseop_names[] = {
     "readlink",
     "chmod",
     "setxattr",
+    "getxattr",
+    "listxattr",
+    "removexattr",
     "statfs",
     "open",
     "read",
@@ -108,10 +169,19 @@ const char* fuseop_names[] = {
     "rename",
     "mkdir",
     "rmdir",
+    "copy_file_range",
+    "fgetattr",
+    "ftruncate",
+    "flush",
+    "fsync",
+    "fallocate",
     "init",
     "destroy"
 };
 
+// Javascript handler for each operation, resolved once by Start()
+static Persistent<Function> f4js_handlers[OP_COUNT];
+
 static struct {
   enum fuseop_t op;
   const char *in_path;
@@ -153,6 +223,9 @@ static struct {
       int flags;
     } setxattr;
 #endif
+    struct {
+      const char *name;
+    } xattr;
    struct {
       off_t offset;
       size_t len;
@@ -165,12 +238,53 @@ static struct {
     struct {
       mode_t mode;
     } create_mkdir;
+    struct {
+      off_t offsetIn;
+      const char *pathOut;
+      struct fuse_file_info *infoOut;
+      off_t offsetOut;
+      size_t len;
+    } copy;
+    struct {
+      int datasync;
+    } fsync;
+    struct {
+      int mode;
+      off_t offset;
+      off_t len;
+    } fallocate;
   } u;
   int retval;
+  std::string xattrValue; // value or name list returned by getxattr/listxattr
+  std::string version;    // optional version token returned by getattr
 } f4js_cmd;
 
 // ---------------------------------------------------------------------------
 
+/*
+ * Operations whose result the kernel ignores, such as release, can be
+ * handed to Javascript without making the FUSE thread wait. They are
+ * queued here and dispatched ahead of the next synchronous command.
+ */
+struct f4js_notification_t {
+  enum fuseop_t op;
+  std::string path;
+  uint64_t fh;
+};
+
+// Upper bound on notifications queued or still being handled in Javascript
+#define F4JS_MAX_PENDING_NOTIFICATIONS 1024
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;                       // signaled when 'pending' drops
+  std::deque<f4js_notification_t> queue;     // not yet dispatched
+  size_t pending;                            // queued, or awaiting their callback
+  bool cmdPending;                           // f4js_cmd awaits dispatch
+} f4js_queue;
+
+// ---------------------------------------------------------------------------
+
 std::string f4js_semaphore_name()
 {
    std::ostringstream o;
@@ -184,6 +298,9 @@ static int f4js_rpc(enum fuseop_t op, const char *path)
 {
   f4js_cmd.op = op;
   f4js_cmd.in_path = path;
+  pthread_mutex_lock(&f4js_queue.lock);
+  f4js_queue.cmdPending = true; // wakeups are coalesced with notifications
+  pthread_mutex_unlock(&f4js_queue.lock);
   uv_async_send(&f4js.async);
   sem_wait(f4js.psem);
   return f4js_cmd.retval;  
@@ -191,10 +308,239 @@ static int f4js_rpc(enum fuseop_t op, const char *path)
 
 // ---------------------------------------------------------------------------
 
+/*
+ * Queue an operation for Javascript and return without waiting for it,
+ * unless too many are already outstanding.
+ */
+static void f4js_notify(enum fuseop_t op, const char *path, uint64_t fh)
+{
+  pthread_mutex_lock(&f4js_queue.lock);
+  while (f4js_queue.pending >= F4JS_MAX_PENDING_NOTIFICATIONS)
+    pthread_cond_wait(&f4js_queue.cond, &f4js_queue.lock);
+  f4js_notification_t notification;
+  notification.op = op;
+  notification.path = path? path : "";
+  notification.fh = fh;
+  f4js_queue.queue.push_back(notification);
+  f4js_queue.pending++;
+  pthread_mutex_unlock(&f4js_queue.lock);
+  uv_async_send(&f4js.async);
+}
+
+// ---------------------------------------------------------------------------
+
+// Wait until Javascript has completed every queued notification
+static void f4js_flush_notifications()
+{
+  pthread_mutex_lock(&f4js_queue.lock);
+  while (f4js_queue.pending > 0)
+    pthread_cond_wait(&f4js_queue.cond, &f4js_queue.lock);
+  pthread_mutex_unlock(&f4js_queue.lock);
+}
+
+// ---------------------------------------------------------------------------
+
+static double f4js_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+// ---------------------------------------------------------------------------
+
+static double f4js_expiry(double expires)
+{
+  return expires;
+}
+
+static double f4js_expiry(const f4js_xattr_t &entry)
+{
+  return entry.expires;
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Make room for one more entry in a cache whose entries all live for the
+ * same time, so that insertion order is also expiration order: drop expired
+ * entries, then the oldest ones while the cache is full. Records of entries
+ * that were since replaced or invalidated are skipped.
+ */
+template <typename T>
+static void f4js_cache_make_room(std::map<std::string, T> &cache,
+                                 f4js_cache_order_t &order, size_t maxEntries)
+{
+  double now = f4js_now();
+  while (!order.empty() && (order.front().first <= now || order.size() >= maxEntries)) {
+    typename std::map<std::string, T>::iterator it = cache.find(order.front().second);
+    if (it != cache.end() && f4js_expiry(it->second) == order.front().first)
+      cache.erase(it);
+    order.pop_front();
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Negative lookup cache. Remembers paths for which getattr() recently
+ * returned -ENOENT, so that repeated probes for nonexistent files are
+ * answered on the FUSE thread without a round trip to Javascript.
+ * Only accessed from the FUSE thread.
+ */
+static bool f4js_negcache_lookup(const char *path)
+{
+  if (f4js.negativeTimeout <= 0)
+    return false;
+  std::map<std::string, double>::iterator it = f4js.negativeCache.find(path);
+  if (it == f4js.negativeCache.end())
+    return false;
+  if (it->second <= f4js_now()) {
+    f4js.negativeCache.erase(it); // expired
+    return false;
+  }
+  return true;
+}
+
+// ---------------------------------------------------------------------------
+
+static void f4js_negcache_insert(const char *path)
+{
+  if (f4js.negativeTimeout <= 0)
+    return;
+  f4js_cache_make_room(f4js.negativeCache, f4js.negativeOrder, F4JS_NEGATIVE_CACHE_MAX_ENTRIES);
+  double expires = f4js_now() + f4js.negativeTimeout;
+  f4js.negativeCache[path] = expires;
+  f4js.negativeOrder.push_back(std::make_pair(expires, std::string(path)));
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Forget cached ENOENT results for a path that just came into existence,
+ * for everything below it (the contents of a renamed directory), and for
+ * its ancestors.
+ */
+static void f4js_negcache_invalidate(const char *path)
+{
+  if (f4js.negativeCache.empty())
+    return;
+  std::string p(path);
+  std::string prefix = p + "/";
+  f4js.negativeCache.erase(p);
+  std::map<std::string, double>::iterator it = f4js.negativeCache.lower_bound(prefix);
+  while (it != f4js.negativeCache.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0) {
+    f4js.negativeCache.erase(it++);
+  }
+  size_t slash;
+  while ((slash = p.rfind('/')) != std::string::npos && slash > 0) {
+    p.erase(slash);
+    f4js.negativeCache.erase(p);
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Metadata manifest. Paths modified through the file system no longer match
+ * the manifest, so they are shadowed: Javascript answers for them from then
+ * on. Only accessed from the FUSE thread.
+ */
+static const manifest_entry_t *f4js_manifest_lookup(const char *path)
+{
+  if (!manifest_loaded())
+    return NULL;
+  if (!f4js.manifestShadowed.empty() && f4js.manifestShadowed.count(path))
+    return NULL;
+  if (!f4js.manifestShadowedTrees.empty()) {
+    std::string p(path);
+    for (;;) {
+      if (f4js.manifestShadowedTrees.count(p))
+        return NULL;
+      size_t slash = p.rfind('/');
+      if (slash == std::string::npos || p == "/")
+        break;
+      p.erase(slash? slash : 1);
+    }
+  }
+  return manifest_lookup(path);
+}
+
+// ---------------------------------------------------------------------------
+
+// The attributes or contents of 'path' changed
+static void f4js_manifest_shadow(const char *path)
+{
+  if (manifest_loaded())
+    f4js.manifestShadowed.insert(path);
+}
+
+// ---------------------------------------------------------------------------
+
+// 'path' was added or removed, which also changes its parent's listing
+static void f4js_manifest_shadow_name(const char *path, bool subtree)
+{
+  if (!manifest_loaded())
+    return;
+  std::string p(path);
+  if (subtree)
+    f4js.manifestShadowedTrees.insert(p);
+  else
+    f4js.manifestShadowed.insert(p);
+  size_t slash = p.rfind('/');
+  if (slash != std::string::npos) {
+    p.erase(slash? slash : 1);
+    f4js.manifestShadowed.insert(p);
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Blocks in the block cache are keyed by a version of the file, which is
+ * the 'version' returned by getattr() if there is one, or else its
+ * modification time and size.
+ */
+static void f4js_blockcache_version(const char *path, const std::string &version,
+                                    const struct stat *stbuf)
+{
+  if (!blockcache_enabled() || !S_ISREG(stbuf->st_mode))
+    return;
+  if (!version.empty()) {
+    blockcache_set_version(path, "v" + version);
+    return;
+  }
+#ifdef __APPLE__
+  const struct timespec *mtime = &stbuf->st_mtimespec;
+#else
+  const struct timespec *mtime = &stbuf->st_mtim;
+#endif
+  std::ostringstream token;
+  token << mtime->tv_sec << '.' << mtime->tv_nsec << ':' << stbuf->st_size;
+  blockcache_set_version(path, token.str());
+}
+
+// ---------------------------------------------------------------------------
+
 static int f4js_getattr(const char *path, struct stat *stbuf)
 {
+  const manifest_entry_t *entry = f4js_manifest_lookup(path);
+  if (entry) {
+    manifest_fill_stat(entry, stbuf);
+    f4js_blockcache_version(path, "", stbuf);
+    return 0;
+  }
+  if (f4js_negcache_lookup(path))
+    return -ENOENT;
   f4js_cmd.u.getattr.stbuf = stbuf;
-  return f4js_rpc(OP_GETATTR, path);
+  f4js_cmd.version.clear();
+  int ret = f4js_rpc(OP_GETATTR, path);
+  if (ret == -ENOENT)
+    f4js_negcache_insert(path);
+  else if (ret == 0)
+    f4js_blockcache_version(path, f4js_cmd.version, stbuf);
+  return ret;
 }
 
 // ---------------------------------------------------------------------------
@@ -202,6 +548,9 @@ static int f4js_getattr(const char *path, struct stat *stbuf)
 static int f4js_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 		         off_t offset, struct fuse_file_info *fi)
 {
+  const manifest_entry_t *entry = f4js_manifest_lookup(path);
+  if (entry)
+    return manifest_readdir(entry, buf, filler);
   f4js_cmd.u.readdir.buf = buf;
   f4js_cmd.u.readdir.filler = filler;
   return f4js_rpc(OP_READDIR, path);
@@ -211,7 +560,9 @@ static int f4js_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 
 static int f4js_readlink(const char *path, char *buf, size_t len)
 {
-
+  const manifest_entry_t *entry = f4js_manifest_lookup(path);
+  if (entry)
+    return manifest_readlink(entry, buf, len);
   f4js_cmd.u.readlink.dstBuf = buf;
   f4js_cmd.u.readlink.len = len;
   return f4js_rpc(OP_READLINK, path);
@@ -219,14 +570,84 @@ static int f4js_readlink(const char *path, char *buf, size_t len)
 
 // ---------------------------------------------------------------------------
 
-static int f4js_chmod(const char *path, mode_t mode)
+/*
+ * Extended attribute cache. Holds getxattr() and listxattr() replies,
+ * including "no such attribute" answers, so that frequent probes such as
+ * security.capability do not go to Javascript. Only accessed from the
+ * FUSE thread.
+ */
+static const f4js_xattr_t *f4js_xattrcache_lookup(const std::string &key)
 {
-  f4js_cmd.u.chmod.mode = mode;
-  return f4js_rpc(OP_CHMOD, path);
+  if (f4js.xattrTimeout <= 0)
+    return NULL;
+  std::map<std::string, f4js_xattr_t>::iterator it = f4js.xattrCache.find(key);
+  if (it == f4js.xattrCache.end())
+    return NULL;
+  if (it->second.expires <= f4js_now()) {
+    f4js.xattrCache.erase(it); // expired
+    return NULL;
+  }
+  return &it->second;
+}
+
+// ---------------------------------------------------------------------------
+
+static void f4js_xattrcache_insert(const std::string &key, int retval, const std::string &value)
+{
+  if (f4js.xattrTimeout <= 0 || (retval != 0 && retval != -ENOATTR))
+    return;
+  f4js_cache_make_room(f4js.xattrCache, f4js.xattrOrder, F4JS_XATTR_CACHE_MAX_ENTRIES);
+  f4js_xattr_t &entry = f4js.xattrCache[key];
+  entry.expires = f4js_now() + f4js.xattrTimeout;
+  entry.retval = retval;
+  entry.value = value;
+  f4js.xattrOrder.push_back(std::make_pair(entry.expires, key));
+}
+
+// ---------------------------------------------------------------------------
+
+static void f4js_xattrcache_erase_prefix(const std::string &prefix)
+{
+  std::map<std::string, f4js_xattr_t>::iterator it = f4js.xattrCache.lower_bound(prefix);
+  while (it != f4js.xattrCache.end() &&
+         it->first.compare(0, prefix.size(), prefix) == 0) {
+    f4js.xattrCache.erase(it++);
+  }
 }
 
 // ---------------------------------------------------------------------------
 
+/*
+ * Forget cached attributes of a path and of everything below it.
+ */
+static void f4js_xattrcache_invalidate(const char *path)
+{
+  if (f4js.xattrCache.empty())
+    return;
+  std::string p(path);
+  f4js_xattrcache_erase_prefix(p + '\0');
+  f4js_xattrcache_erase_prefix(p + '/');
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Copy an attribute value or name list to the caller's buffer, following
+ * the getxattr(2) convention that a zero size only queries the length.
+ */
+static int f4js_xattr_reply(int retval, const std::string &value, char *buf, size_t size)
+{
+  if (retval != 0)
+    return retval;
+  if (size == 0)
+    return value.size();
+  if (value.size() > size)
+    return -ERANGE;
+  memcpy(buf, value.data(), value.size());
+  return value.size();
+}
+
+// ---------------------------------------------------------------------------
 
 #ifdef __APPLE__
 static int f4js_setxattr(const char *path, const char* name, const char* value, size_t size, int position, uint32_t options)
@@ -236,7 +657,9 @@ static int f4js_setxattr(const char *path, const char* name, const char* value,
   f4js_cmd.u.setxattr.size = size;
   f4js_cmd.u.setxattr.position = position;
   f4js_cmd.u.setxattr.options = options;
-  return f4js_rpc(OP_SETXATTR, path);
+  int ret = f4js_rpc(OP_SETXATTR, path);
+  f4js_xattrcache_invalidate(path);
+  return ret;
 }
 #else
 static int f4js_setxattr(const char *path, const char* name, const char* value, size_t size, int flags)
@@ -245,10 +668,68 @@ static int f4js_setxattr(const char *path, const char* name, const char* value,
   f4js_cmd.u.setxattr.value = value;
   f4js_cmd.u.setxattr.size = size;
   f4js_cmd.u.setxattr.flags = flags;
-  return f4js_rpc(OP_SETXATTR, path);
+  int ret = f4js_rpc(OP_SETXATTR, path);
+  f4js_xattrcache_invalidate(path);
+  return ret;
 }
 #endif
 
+// ---------------------------------------------------------------------------
+
+#ifdef __APPLE__
+static int f4js_getxattr(const char *path, const char* name, char* value, size_t size, uint32_t position)
+#else
+static int f4js_getxattr(const char *path, const char* name, char* value, size_t size)
+#endif
+{
+  std::string key = std::string(path) + '\0' + name;
+  const f4js_xattr_t *cached = f4js_xattrcache_lookup(key);
+  if (cached)
+    return f4js_xattr_reply(cached->retval, cached->value, value, size);
+
+  f4js_cmd.u.xattr.name = name;
+  f4js_cmd.xattrValue.clear();
+  int ret = f4js_rpc(OP_GETXATTR, path);
+  f4js_xattrcache_insert(key, ret, f4js_cmd.xattrValue);
+  return f4js_xattr_reply(ret, f4js_cmd.xattrValue, value, size);
+}
+
+// ---------------------------------------------------------------------------
+
+static int f4js_listxattr(const char *path, char *list, size_t size)
+{
+  std::string key = std::string(path) + '\0';
+  const f4js_xattr_t *cached = f4js_xattrcache_lookup(key);
+  if (cached)
+    return f4js_xattr_reply(cached->retval, cached->value, list, size);
+
+  f4js_cmd.xattrValue.clear();
+  int ret = f4js_rpc(OP_LISTXATTR, path);
+  f4js_xattrcache_insert(key, ret, f4js_cmd.xattrValue);
+  return f4js_xattr_reply(ret, f4js_cmd.xattrValue, list, size);
+}
+
+// ---------------------------------------------------------------------------
+
+static int f4js_removexattr(const char *path, const char *name)
+{
+  f4js_cmd.u.xattr.name = name;
+  int ret = f4js_rpc(OP_REMOVEXATTR, path);
+  f4js_xattrcache_invalidate(path);
+  return ret;
+}
+
+
+// ---------------------------------------------------------------------------
+
+static int f4js_chmod(const char *path, mode_t mode)
+{
+  f4js_cmd.u.chmod.mode = mode;
+  f4js_manifest_shadow(path);
+  int ret = f4js_rpc(OP_CHMOD, path);
+  f4js_xattrcache_invalidate(path); // may change ACL attributes
+  return ret;
+}
 
 // ---------------------------------------------------------------------------
 
@@ -268,12 +749,61 @@ int f4js_open(const char *path, struct fuse_file_info *info)
 
 // ---------------------------------------------------------------------------
 
+// Returns the number of bytes in the block, or a negative error
+static int f4js_read_block(const char *path, uint64_t block, char *buf,
+                           struct fuse_file_info *info)
+{
+  ssize_t cached = blockcache_get(path, block, buf);
+  if (cached >= 0)
+    return cached;
+  f4js_cmd.info = info;
+  f4js_cmd.u.rw.offset = block * BLOCKCACHE_BLOCK_SIZE;
+  f4js_cmd.u.rw.len = BLOCKCACHE_BLOCK_SIZE;
+  f4js_cmd.u.rw.dstBuf = buf;
+  int ret = f4js_rpc(OP_READ, path);
+  if (ret >= 0)
+    blockcache_put(path, block, buf, ret);
+  return ret;
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Serve a read from whole blocks of the block cache, fetching missing
+ * blocks from Javascript. A short block marks the end of the file.
+ */
+static int f4js_cached_read(const char *path, char *buf, size_t len, off_t offset,
+                            struct fuse_file_info *info)
+{
+  static char block[BLOCKCACHE_BLOCK_SIZE]; // the FUSE loop is single threaded
+  size_t done = 0;
+  while (done < len) {
+    uint64_t pos = offset + done;
+    size_t within = pos % BLOCKCACHE_BLOCK_SIZE;
+    int n = f4js_read_block(path, pos / BLOCKCACHE_BLOCK_SIZE, block, info);
+    if (n < 0)
+      return done? (int)done : n;
+    if ((size_t)n <= within)
+      break;
+    size_t chunk = std::min(len - done, (size_t)n - within);
+    memcpy(buf + done, block + within, chunk);
+    done += chunk;
+    if (n < BLOCKCACHE_BLOCK_SIZE)
+      break;
+  }
+  return done;
+}
+
+// ---------------------------------------------------------------------------
+
 int f4js_read (const char *path,
                char *buf,
                size_t len,
                off_t offset,
                struct fuse_file_info *info)
 {
+  if (blockcache_has_version(path) && !info->direct_io)
+    return f4js_cached_read(path, buf, len, offset, info);
   f4js_cmd.info = info;
   f4js_cmd.u.rw.offset = offset;
   f4js_cmd.u.rw.len = len;
@@ -293,6 +823,8 @@ int f4js_write (const char *path,
   f4js_cmd.u.rw.offset = offset;
   f4js_cmd.u.rw.len = len;
   f4js_cmd.u.rw.srcBuf = buf;
+  f4js_manifest_shadow(path);
+  blockcache_invalidate(path, false);
   return f4js_rpc(OP_WRITE, path);
 }
 
@@ -300,6 +832,10 @@ int f4js_write (const char *path,
 
 int f4js_release (const char *path, struct fuse_file_info *info)
 {
+  if (f4js.asyncRelease) {
+    f4js_notify(OP_RELEASE, path, info->fh); // the kernel ignores the result
+    return 0;
+  }
   f4js_cmd.info = info;
   return f4js_rpc(OP_RELEASE, path);
 }
@@ -312,7 +848,14 @@ int f4js_create (const char *path,
 {
   f4js_cmd.info = info;
   f4js_cmd.u.create_mkdir.mode = mode;
-  return f4js_rpc(OP_CREATE, path);
+  f4js_manifest_shadow_name(path, false);
+  blockcache_invalidate(path, false);
+  int ret = f4js_rpc(OP_CREATE, path);
+  if (ret == 0) {
+    f4js_negcache_invalidate(path);
+    f4js_xattrcache_invalidate(path);
+  }
+  return ret;
 }
 
 // ---------------------------------------------------------------------------
@@ -327,7 +870,11 @@ int f4js_utimens (const char *,
 
 int f4js_unlink (const char *path)
 {
-  return f4js_rpc(OP_UNLINK, path);
+  f4js_manifest_shadow_name(path, false);
+  blockcache_invalidate(path, false);
+  int ret = f4js_rpc(OP_UNLINK, path);
+  f4js_xattrcache_invalidate(path);
+  return ret;
 }
 
 // ---------------------------------------------------------------------------
@@ -335,7 +882,17 @@ int f4js_unlink (const char *path)
 int f4js_rename (const char *src, const char *dst)
 {
   f4js_cmd.u.rename.dst = dst;
-  return f4js_rpc(OP_RENAME, src);
+  f4js_manifest_shadow_name(src, true);
+  f4js_manifest_shadow_name(dst, true);
+  blockcache_invalidate(src, true);
+  blockcache_invalidate(dst, true);
+  int ret = f4js_rpc(OP_RENAME, src);
+  if (ret == 0) {
+    f4js_negcache_invalidate(dst);
+    f4js_xattrcache_invalidate(src);
+    f4js_xattrcache_invalidate(dst);
+  }
+  return ret;
 }
 
 // ---------------------------------------------------------------------------
@@ -343,25 +900,119 @@ int f4js_rename (const char *src, const char *dst)
 int f4js_mkdir (const char *path, mode_t mode)
 {
   f4js_cmd.u.create_mkdir.mode = mode;
-  return f4js_rpc(OP_MKDIR, path);
+  f4js_manifest_shadow_name(path, false);
+  int ret = f4js_rpc(OP_MKDIR, path);
+  if (ret == 0) {
+    f4js_negcache_invalidate(path);
+    f4js_xattrcache_invalidate(path);
+  }
+  return ret;
 }
 
 // ---------------------------------------------------------------------------
 
 int f4js_rmdir (const char *path)
 {
-  return f4js_rpc(OP_RMDIR, path);
+  f4js_manifest_shadow_name(path, false);
+  int ret = f4js_rpc(OP_RMDIR, path);
+  f4js_xattrcache_invalidate(path);
+  return ret;
 }
 
 // ---------------------------------------------------------------------------
 
 int f4js_truncate (const char *path, off_t size) {
   f4js_cmd.u.truncate.size = size;
+  f4js_manifest_shadow(path);
+  blockcache_invalidate(path, false);
   return f4js_rpc(OP_TRUNCATE, path);
 }
 
 // ---------------------------------------------------------------------------
 
+#ifdef F4JS_HAVE_COPY_FILE_RANGE
+ssize_t f4js_copy_file_range (const char *pathIn, struct fuse_file_info *infoIn, off_t offsetIn,
+                              const char *pathOut, struct fuse_file_info *infoOut, off_t offsetOut,
+                              size_t len, int flags)
+{
+  f4js_cmd.info = infoIn;
+  f4js_cmd.u.copy.offsetIn = offsetIn;
+  f4js_cmd.u.copy.pathOut = pathOut;
+  f4js_cmd.u.copy.infoOut = infoOut;
+  f4js_cmd.u.copy.offsetOut = offsetOut;
+  // Keep each request to a size Javascript can buffer; the kernel asks
+  // again for the rest
+  f4js_cmd.u.copy.len = std::min(len, (size_t)F4JS_MAX_COPY_SIZE);
+  f4js_manifest_shadow(pathOut);
+  blockcache_invalidate(pathOut, false);
+  return f4js_rpc(OP_COPY_FILE_RANGE, pathIn);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+
+/*
+ * The following operations act on a file opened by open() or create(),
+ * and pass its file handle to Javascript. Each one is only registered
+ * when it has a handler.
+ */
+int f4js_fgetattr (const char *path, struct stat *stbuf, struct fuse_file_info *info)
+{
+  f4js_cmd.info = info;
+  f4js_cmd.u.getattr.stbuf = stbuf;
+  f4js_cmd.version.clear();
+  int ret = f4js_rpc(OP_FGETATTR, path);
+  if (ret == 0)
+    f4js_blockcache_version(path, f4js_cmd.version, stbuf);
+  return ret;
+}
+
+// ---------------------------------------------------------------------------
+
+int f4js_ftruncate (const char *path, off_t size, struct fuse_file_info *info)
+{
+  f4js_cmd.info = info;
+  f4js_cmd.u.truncate.size = size;
+  f4js_manifest_shadow(path);
+  blockcache_invalidate(path, false);
+  return f4js_rpc(OP_FTRUNCATE, path);
+}
+
+// ---------------------------------------------------------------------------
+
+int f4js_flush (const char *path, struct fuse_file_info *info)
+{
+  f4js_cmd.info = info;
+  return f4js_rpc(OP_FLUSH, path);
+}
+
+// ---------------------------------------------------------------------------
+
+int f4js_fsync (const char *path, int datasync, struct fuse_file_info *info)
+{
+  f4js_cmd.info = info;
+  f4js_cmd.u.fsync.datasync = datasync;
+  return f4js_rpc(OP_FSYNC, path);
+}
+
+// ---------------------------------------------------------------------------
+
+#ifdef F4JS_HAVE_FALLOCATE
+int f4js_fallocate (const char *path, int mode, off_t offset, off_t len,
+                    struct fuse_file_info *info)
+{
+  f4js_cmd.info = info;
+  f4js_cmd.u.fallocate.mode = mode;
+  f4js_cmd.u.fallocate.offset = offset;
+  f4js_cmd.u.fallocate.len = len;
+  f4js_manifest_shadow(path);
+  blockcache_invalidate(path, false);
+  return f4js_rpc(OP_FALLOCATE, path);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+
 void* f4js_init(struct fuse_conn_info *conn)
 {
   // We currently always return NULL
@@ -374,32 +1025,148 @@ void* f4js_init(struct fuse_conn_info *conn)
 void f4js_destroy (void *data)
 {
   // We currently ignore the data pointer, which init() always sets to NULL
+  f4js_flush_notifications(); // let queued releases finish before destroy()
   f4js_rpc(OP_DESTROY, "");
 }
 
 // ---------------------------------------------------------------------------
 
+#ifdef F4JS_FUSE3
+/*
+ * libfuse 3 added parameters to these operations. The Javascript interface
+ * is the same with either library, so the extra arguments are dropped.
+ * getattr and truncate on an open file carry its file_info instead of
+ * going to separate fgetattr and ftruncate operations.
+ */
+static int f4js_getattr3(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+  if (fi && !f4js_handlers[OP_FGETATTR].IsEmpty())
+    return f4js_fgetattr(path, stbuf, fi);
+  return f4js_getattr(path, stbuf);
+}
+
+static int f4js_readdir3(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi,
+                         enum fuse_readdir_flags flags)
+{
+  return f4js_readdir(path, buf, filler, offset, fi);
+}
+
+static int f4js_chmod3(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+  return f4js_chmod(path, mode);
+}
+
+static int f4js_truncate3(const char *path, off_t size, struct fuse_file_info *fi)
+{
+  if (fi && !f4js_handlers[OP_FTRUNCATE].IsEmpty())
+    return f4js_ftruncate(path, size, fi);
+  return f4js_truncate(path, size);
+}
+
+static int f4js_utimens3(const char *path, const struct timespec tv[2], struct fuse_file_info *fi)
+{
+  return f4js_utimens(path, tv);
+}
+
+static int f4js_rename3(const char *src, const char *dst, unsigned int flags)
+{
+  if (flags)
+    return -EINVAL; // RENAME_NOREPLACE and RENAME_EXCHANGE are not supported
+  return f4js_rename(src, dst);
+}
+
+static void *f4js_init3(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+  return f4js_init(conn);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Whether an operation goes to Javascript. All of them do normally. With
+ * the inMemory option, only those that have a handler do, and they take
+ * over the operation from the engine.
+ */
+static bool f4js_use_handler(enum fuseop_t op)
+{
+  return !f4js.inMemory || !f4js_handlers[op].IsEmpty();
+}
+
+// ---------------------------------------------------------------------------
+
 void *fuse_thread(void *)
 {
   struct fuse_operations ops = { 0 };
-  ops.truncate = f4js_truncate;
-  ops.getattr = f4js_getattr;
-  ops.readdir = f4js_readdir;
-  ops.readlink = f4js_readlink;
-  ops.chmod = f4js_chmod;
-  ops.setxattr = f4js_setxattr;
-  ops.statfs = f4js_statfs;
-  ops.open = f4js_open;
-  ops.read = f4js_read;
-  ops.write = f4js_write;
-  ops.release = f4js_release;
-  ops.create = f4js_create;
-  ops.utimens = f4js_utimens;
-  ops.unlink = f4js_unlink;
-  ops.rename = f4js_rename;
-  ops.mkdir = f4js_mkdir;
-  ops.rmdir = f4js_rmdir;
-  ops.init = f4js_init;
+  if (f4js.inMemory)
+    memfs_register_ops(&ops);
+
+  if (f4js_use_handler(OP_TRUNCATE))
+    ops.truncate = F4JS_OP3(f4js_truncate);
+  if (f4js_use_handler(OP_GETATTR))
+    ops.getattr = F4JS_OP3(f4js_getattr);
+  if (f4js_use_handler(OP_READDIR))
+    ops.readdir = F4JS_OP3(f4js_readdir);
+  if (f4js_use_handler(OP_READLINK))
+    ops.readlink = f4js_readlink;
+  if (f4js_use_handler(OP_CHMOD))
+    ops.chmod = F4JS_OP3(f4js_chmod);
+  if (f4js_use_handler(OP_SETXATTR))
+    ops.setxattr = f4js_setxattr;
+  // Leave these unset without a handler, so the kernel learns
+  // from ENOSYS to stop asking instead of getting EPERM each time
+  if (!f4js_handlers[OP_GETXATTR].IsEmpty())
+    ops.getxattr = f4js_getxattr;
+  if (!f4js_handlers[OP_LISTXATTR].IsEmpty())
+    ops.listxattr = f4js_listxattr;
+  if (!f4js_handlers[OP_REMOVEXATTR].IsEmpty())
+    ops.removexattr = f4js_removexattr;
+  if (f4js_use_handler(OP_STATFS))
+    ops.statfs = f4js_statfs;
+  // The engine's file handles point to its nodes, so open files are
+  // served either entirely by the engine or entirely by Javascript
+  if (f4js_use_handler(OP_OPEN) || f4js_use_handler(OP_CREATE) ||
+      f4js_use_handler(OP_READ) || f4js_use_handler(OP_WRITE) ||
+      f4js_use_handler(OP_RELEASE)) {
+    ops.open = f4js_open;
+    ops.read = f4js_read;
+    ops.write = f4js_write;
+    ops.release = f4js_release;
+    ops.create = f4js_create;
+  }
+  if (!f4js.inMemory)
+    ops.utimens = F4JS_OP3(f4js_utimens);
+  if (f4js_use_handler(OP_UNLINK))
+    ops.unlink = f4js_unlink;
+  if (f4js_use_handler(OP_RENAME))
+    ops.rename = F4JS_OP3(f4js_rename);
+  if (f4js_use_handler(OP_MKDIR))
+    ops.mkdir = f4js_mkdir;
+  if (f4js_use_handler(OP_RMDIR))
+    ops.rmdir = f4js_rmdir;
+#ifdef F4JS_HAVE_COPY_FILE_RANGE
+  // Without a handler, ENOSYS makes the kernel fall back to read/write
+  if (!f4js_handlers[OP_COPY_FILE_RANGE].IsEmpty())
+    ops.copy_file_range = f4js_copy_file_range;
+#endif
+#ifndef F4JS_FUSE3
+  // Without these, libfuse falls back to getattr() and truncate()
+  if (!f4js_handlers[OP_FGETATTR].IsEmpty())
+    ops.fgetattr = f4js_fgetattr;
+  if (!f4js_handlers[OP_FTRUNCATE].IsEmpty())
+    ops.ftruncate = f4js_ftruncate;
+#endif
+  // Without a handler, the kernel treats flush and fsync as no-ops
+  if (!f4js_handlers[OP_FLUSH].IsEmpty())
+    ops.flush = f4js_flush;
+  if (!f4js_handlers[OP_FSYNC].IsEmpty())
+    ops.fsync = f4js_fsync;
+#ifdef F4JS_HAVE_FALLOCATE
+  if (!f4js_handlers[OP_FALLOCATE].IsEmpty())
+    ops.fallocate = f4js_fallocate;
+#endif
+  ops.init = F4JS_OP3(f4js_init);
   ops.destroy = f4js_destroy;
   const char* debugOption = f4js.enableFuseDebug? "-d":"-f";
   char *argv[] = { (char*)"dummy", (char*)"-s", (char*)debugOption, (char*)f4js.root.c_str() };
@@ -496,6 +1263,11 @@ NAN_METHOD(GetAttrCompletion)
     ConvertDate(stat, "atime", &stbuf->st_atim);
 #endif
 
+    prop = stat->Get(NanNew<String>("version"));
+    if (!prop->IsUndefined() && (prop->IsString() || prop->IsNumber())) {
+      String::Utf8Value version(prop);
+      f4js_cmd.version.assign(*version, version.length());
+    }
   }
   sem_post(f4js.psem);
   NanReturnUndefined();
@@ -516,7 +1288,7 @@ NAN_METHOD(ReadDirCompletion)
         String::Utf8Value av(name);  
         struct stat st;
         memset(&st, 0, sizeof(st)); // structure not used. Zero everything.
-        if (f4js_cmd.u.readdir.filler(f4js_cmd.u.readdir.buf, *av, &st, 0))
+        if (F4JS_FILL_DIR(f4js_cmd.u.readdir.filler, f4js_cmd.u.readdir.buf, *av, &st))
           break;            
       }
     }
@@ -624,6 +1396,36 @@ NAN_METHOD( ReadLinkCompletion)
 
 // ---------------------------------------------------------------------------
 
+NAN_METHOD(XattrCompletion)
+{
+  NanScope();
+  ProcessReturnValue(args);
+  if (f4js_cmd.retval == 0 && args.Length() >= 2) {
+    if (args[1]->IsArray()) {
+      // listxattr: NUL terminated names, back to back
+      Handle<Array> ar = Handle<Array>::Cast(args[1]);
+      for (uint32_t i = 0; i < ar->Length(); i++) {
+        Local<Value> el = ar->Get(i);
+        if (!el->IsUndefined() && el->IsString()) {
+          String::Utf8Value av(el);
+          f4js_cmd.xattrValue.append(*av, av.length());
+          f4js_cmd.xattrValue.push_back('\0');
+        }
+      }
+    } else if (node::Buffer::HasInstance(args[1])) {
+      Local<Object> buf = args[1]->ToObject();
+      f4js_cmd.xattrValue.assign(node::Buffer::Data(buf), node::Buffer::Length(buf));
+    } else if (args[1]->IsString()) {
+      String::Utf8Value av(args[1]);
+      f4js_cmd.xattrValue.assign(*av, av.length());
+    }
+  }
+  sem_post(f4js.psem);
+  NanReturnUndefined();
+}
+
+// ---------------------------------------------------------------------------
+
 NAN_METHOD(GenericCompletion)
 {
   NanScope();
@@ -646,11 +1448,36 @@ NAN_METHOD(OpenCreateCompletion)
 {
   NanScope();
   ProcessReturnValue(args);
+  f4js_cmd.info->fh = 0;
   if (f4js_cmd.retval == 0 && args.Length() >= 2 && args[1]->IsNumber()) {
     Local<Number> fileHandle = Local<Number>::Cast(args[1]);
     f4js_cmd.info->fh = (uint64_t)fileHandle->Value(); // save the file handle
-  } else {
-    f4js_cmd.info->fh = 0;
+  } else if (f4js_cmd.retval == 0 && args.Length() >= 2 && args[1]->IsObject()) {
+    // Options object: the file handle plus page cache flags for this open
+    Handle<Object> options = Handle<Object>::Cast(args[1]);
+
+    Local<Value> prop = options->Get(NanNew<String>("fh"));
+    if (!prop->IsUndefined() && prop->IsNumber()) {
+      Local<Number> num = Local<Number>::Cast(prop);
+      f4js_cmd.info->fh = (uint64_t)num->Value();
+    }
+
+    prop = options->Get(NanNew<String>("keep_cache"));
+    if (!prop->IsUndefined()) {
+      f4js_cmd.info->keep_cache = prop->BooleanValue();
+    }
+
+    prop = options->Get(NanNew<String>("direct_io"));
+    if (!prop->IsUndefined()) {
+      f4js_cmd.info->direct_io = prop->BooleanValue();
+    }
+
+#if FUSE_VERSION >= 28
+    prop = options->Get(NanNew<String>("nonseekable"));
+    if (!prop->IsUndefined()) {
+      f4js_cmd.info->nonseekable = prop->BooleanValue();
+    }
+#endif
   }
   sem_post(f4js.psem);
   NanReturnUndefined();
@@ -687,14 +1514,74 @@ NAN_METHOD(WriteCompletion)
 
 // ---------------------------------------------------------------------------
 
+static void NotificationDone()
+{
+  pthread_mutex_lock(&f4js_queue.lock);
+  f4js_queue.pending--;
+  pthread_cond_broadcast(&f4js_queue.cond);
+  pthread_mutex_unlock(&f4js_queue.lock);
+}
+
+// ---------------------------------------------------------------------------
+
+NAN_METHOD(NotifyCompletion)
+{
+  NanScope();
+  NotificationDone(); // the result is ignored
+  NanReturnUndefined();
+}
+
+// ---------------------------------------------------------------------------
+
+// Called from the main thread.
+static void DispatchNotifications()
+{
+  NanScope();
+  std::deque<f4js_notification_t> batch;
+  pthread_mutex_lock(&f4js_queue.lock);
+  batch.swap(f4js_queue.queue);
+  pthread_mutex_unlock(&f4js_queue.lock);
+
+  for (size_t i = 0; i < batch.size(); i++) {
+    f4js_notification_t &notification = batch[i];
+    if (f4js_handlers[notification.op].IsEmpty()) {
+      NotificationDone();
+      continue;
+    }
+    Handle<Value> argv[3];
+    argv[0] = NanNew<String>(notification.path.c_str());
+    argv[1] = NanNew<Number>((double)notification.fh);
+    argv[2] = NanNew(f4js.NotifyFunc);
+    Local<Function> handler = NanNew(f4js_handlers[notification.op]);
+    handler->Call(NanGetCurrentContext()->Global(), 3, argv);
+  }
+}
+
+// ---------------------------------------------------------------------------
+
 // Called from the main thread.
 static void DispatchOp(uv_async_t* handle, int status)
 {
   NanScope();
-  std::string symName(fuseop_names[f4js_cmd.op]);
+  DispatchNotifications();
+
+  pthread_mutex_lock(&f4js_queue.lock);
+  bool cmdPending = f4js_queue.cmdPending;
+  f4js_queue.cmdPending = false;
+  pthread_mutex_unlock(&f4js_queue.lock);
+  if (!cmdPending)
+    return;
+
+  if (f4js_handlers[f4js_cmd.op].IsEmpty()) {
+    // No handler: fail the request, except for init/destroy which always succeed
+    bool lifecycle = (f4js_cmd.op == OP_INIT || f4js_cmd.op == OP_DESTROY);
+    f4js_cmd.retval = lifecycle? 0 : -EPERM;
+    sem_post(f4js.psem);
+    return;
+  }
   f4js_cmd.retval = -EPERM;
   int argc = 0;
-  Handle<Value> argv[6]; 
+  Handle<Value> argv[8]; 
   Local<String> path = NanNew<String>(f4js_cmd.in_path); 
   argv[argc++] = path;
   switch (f4js_cmd.op) {
@@ -708,6 +1595,7 @@ static void DispatchOp(uv_async_t* handle, int status)
 
   case OP_TRUNCATE:
     argv[argc++] = NanNew((double)f4js_cmd.u.truncate.size);
+    argv[argc++] = NanNew(f4js.GenericFunc);
     break;
 
   case OP_GETATTR:
@@ -724,6 +1612,7 @@ static void DispatchOp(uv_async_t* handle, int status)
 
   case OP_CHMOD:
     argv[argc++] = NanNew<Number>((double)f4js_cmd.u.chmod.mode);
+    argv[argc++] = NanNew(f4js.GenericFunc);
     break;
 
   case OP_SETXATTR:
@@ -736,6 +1625,21 @@ static void DispatchOp(uv_async_t* handle, int status)
 #else
     argv[argc++] = NanNew<Number>((double)f4js_cmd.u.setxattr.flags);
 #endif
+    argv[argc++] = NanNew(f4js.GenericFunc);
+    break;
+
+  case OP_GETXATTR:
+    argv[argc++] = NanNew<String>(f4js_cmd.u.xattr.name);
+    argv[argc++] = NanNew(f4js.XattrFunc);
+    break;
+
+  case OP_LISTXATTR:
+    argv[argc++] = NanNew(f4js.XattrFunc);
+    break;
+
+  case OP_REMOVEXATTR:
+    argv[argc++] = NanNew<String>(f4js_cmd.u.xattr.name);
+    argv[argc++] = NanNew(f4js.GenericFunc);
     break;
 
   case OP_STATFS:
@@ -786,25 +1690,83 @@ static void DispatchOp(uv_async_t* handle, int status)
     argv[argc++] = NanNew<Number>((double)f4js_cmd.info->fh); // optional file handle returned by open()
     argv[argc++] = NanNew(f4js.GenericFunc);
     break;
+
+  case OP_COPY_FILE_RANGE:
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.info->fh);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.u.copy.offsetIn);
+    argv[argc++] = NanNew<String>(f4js_cmd.u.copy.pathOut);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.u.copy.infoOut->fh);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.u.copy.offsetOut);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.u.copy.len);
+    argv[argc++] = NanNew(f4js.GenericFunc);
+    break;
+
+  case OP_FGETATTR:
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.info->fh);
+    argv[argc++] = NanNew(f4js.GetAttrFunc);
+    break;
+
+  case OP_FTRUNCATE:
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.u.truncate.size);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.info->fh);
+    argv[argc++] = NanNew(f4js.GenericFunc);
+    break;
+
+  case OP_FLUSH:
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.info->fh);
+    argv[argc++] = NanNew(f4js.GenericFunc);
+    break;
+
+  case OP_FSYNC:
+    argv[argc++] = NanNew(f4js_cmd.u.fsync.datasync != 0);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.info->fh);
+    argv[argc++] = NanNew(f4js.GenericFunc);
+    break;
+
+  case OP_FALLOCATE:
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.u.fallocate.mode);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.u.fallocate.offset);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.u.fallocate.len);
+    argv[argc++] = NanNew<Number>((double)f4js_cmd.info->fh);
+    argv[argc++] = NanNew(f4js.GenericFunc);
+    break;
     
   default:
     argv[argc++] = NanNew(f4js.GenericFunc);
     break;
   }
   
-  Local<Function> handler = Local<Function>::Cast(
-    NanNew(f4js.handlers)->Get(NanNew<String>(symName.c_str()))
-  );
-  if (handler->IsUndefined()) {
-    sem_post(f4js.psem);
-    return;
-  }
+  Local<Function> handler = NanNew(f4js_handlers[f4js_cmd.op]);
   handler->Call(NanGetCurrentContext()->Global(), argc, argv);
   // NanReturnUndefined();
 }
 
 // ---------------------------------------------------------------------------
 
+/*
+ * Seed the in-memory engine from an object in jsonFS format:
+ * objects are directories and strings are file contents.
+ */
+static void ImportMemFS(const std::string &path, Handle<Object> dir)
+{
+  Local<Array> names = dir->GetOwnPropertyNames();
+  for (uint32_t i = 0; i < names->Length(); i++) {
+    Local<Value> name = names->Get(i);
+    Local<Value> value = dir->Get(name);
+    String::Utf8Value av(name);
+    std::string childPath = path + "/" + *av;
+    if (value->IsString()) {
+      String::Utf8Value data(value);
+      memfs_import_file(childPath.c_str(), *data, data.length());
+    } else if (value->IsObject()) {
+      memfs_import_dir(childPath.c_str());
+      ImportMemFS(childPath, Handle<Object>::Cast(value));
+    }
+  }
+}
+
+// ---------------------------------------------------------------------------
+
 NAN_METHOD(Start)
 {
   NanScope();
@@ -832,7 +1794,7 @@ NAN_METHOD(Start)
   }
 
   f4js.extraArgc = 0;
-  if (args.Length() >= 4) {
+  if (args.Length() >= 4 && !args[3]->IsUndefined()) {
     if (!args[3]->IsArray()) {
         NanThrowTypeError("Wrong argument types");
         NanReturnUndefined();
@@ -858,8 +1820,81 @@ NAN_METHOD(Start)
     }
   }
   
+  f4js.inMemory = false;
+  f4js.asyncRelease = false;
+  f4js.negativeTimeout = 0;
+  f4js.xattrTimeout = 0;
+  if (args.Length() >= 5 && args[4]->IsObject()) {
+    Handle<Object> options = Handle<Object>::Cast(args[4]);
+
+    Local<Value> prop = options->Get(NanNew<String>("negativeTimeout"));
+    if (!prop->IsUndefined() && prop->IsNumber()) {
+      Local<Number> num = Local<Number>::Cast(prop);
+      f4js.negativeTimeout = num->Value();
+    }
+
+    prop = options->Get(NanNew<String>("inMemory"));
+    if (!prop->IsUndefined() && (prop->IsObject() || prop->BooleanValue())) {
+      f4js.inMemory = true;
+      memfs_reset();
+      if (prop->IsObject())
+        ImportMemFS("", Handle<Object>::Cast(prop));
+    }
+
+    prop = options->Get(NanNew<String>("manifest"));
+    if (!prop->IsUndefined() && prop->IsString()) {
+      String::Utf8Value file(prop);
+      std::string error;
+      if (!manifest_open(*file, &error)) {
+        NanThrowError(error.c_str());
+        NanReturnUndefined();
+      }
+    }
+
+    prop = options->Get(NanNew<String>("asyncRelease"));
+    if (!prop->IsUndefined()) {
+      f4js.asyncRelease = prop->BooleanValue();
+    }
+
+    prop = options->Get(NanNew<String>("xattrTimeout"));
+    if (!prop->IsUndefined() && prop->IsNumber()) {
+      Local<Number> num = Local<Number>::Cast(prop);
+      f4js.xattrTimeout = num->Value();
+    }
+
+    prop = options->Get(NanNew<String>("blockCache"));
+    if (!prop->IsUndefined() && prop->IsString() && !f4js.inMemory) {
+      String::Utf8Value dir(prop);
+      uint64_t maxBytes = F4JS_DEFAULT_BLOCK_CACHE_SIZE;
+      Local<Value> size = options->Get(NanNew<String>("blockCacheSize"));
+      if (!size->IsUndefined() && size->IsNumber()) {
+        maxBytes = (uint64_t)Local<Number>::Cast(size)->Value();
+      }
+      std::string error;
+      if (!blockcache_open(*dir, maxBytes, &error)) {
+        NanThrowError(error.c_str());
+        NanReturnUndefined();
+      }
+    }
+  }
+  f4js.negativeCache.clear();
+  f4js.negativeOrder.clear();
+  f4js.xattrCache.clear();
+  f4js.xattrOrder.clear();
+  f4js.manifestShadowed.clear();
+  f4js.manifestShadowedTrees.clear();
+
   f4js.root = root;
-  NanAssignPersistent( f4js.handlers, Local<Object>::Cast(args[1]) );
+
+  // Look up the handlers once, rather than by name on every request
+  Local<Object> handlers = Local<Object>::Cast(args[1]);
+  for (int op = 0; op < OP_COUNT; op++) {
+    NanDisposePersistent(f4js_handlers[op]);
+    Local<Value> handler = handlers->Get(NanNew<String>(fuseop_names[op]));
+    if (!handler->IsUndefined() && handler->IsFunction()) {
+      NanAssignPersistent(f4js_handlers[op], Local<Function>::Cast(handler));
+    }
+  }
 
   f4js.psem = sem_open(f4js_semaphore_name().c_str(), O_CREAT, S_IRUSR | S_IWUSR, 0);
   if (f4js.psem == SEM_FAILED)
@@ -877,8 +1912,15 @@ NAN_METHOD(Start)
   NanAssignPersistent(f4js.OpenCreateFunc, NanNew<FunctionTemplate>(OpenCreateCompletion)->GetFunction());
   NanAssignPersistent(f4js.ReadFunc, NanNew<FunctionTemplate>(ReadCompletion)->GetFunction());
   NanAssignPersistent(f4js.WriteFunc, NanNew<FunctionTemplate>(WriteCompletion)->GetFunction());
+  NanAssignPersistent(f4js.XattrFunc, NanNew<FunctionTemplate>(XattrCompletion)->GetFunction());
+  NanAssignPersistent(f4js.NotifyFunc, NanNew<FunctionTemplate>(NotifyCompletion)->GetFunction());
   NanAssignPersistent(f4js.GenericFunc, NanNew<FunctionTemplate>(GenericCompletion)->GetFunction());
 
+  pthread_mutex_init(&f4js_queue.lock, NULL);
+  pthread_cond_init(&f4js_queue.cond, NULL);
+  f4js_queue.pending = 0;
+  f4js_queue.cmdPending = false;
+
   uv_async_init(uv_default_loop(), &f4js.async, (uv_async_cb) DispatchOp);
 
   pthread_attr_t attr;
@@ -889,9 +1931,44 @@ NAN_METHOD(Start)
 
 // ---------------------------------------------------------------------------
 
+NAN_METHOD(Snapshot)
+{
+  NanScope();
+  if (!f4js.inMemory) {
+    NanThrowError("File system was not started with the inMemory option");
+    NanReturnUndefined();
+  }
+  std::string json = memfs_snapshot();
+  NanReturnValue(NanNew<String>(json.c_str(), json.size()));
+}
+
+// ---------------------------------------------------------------------------
+
+NAN_METHOD(BlockCacheStats)
+{
+  NanScope();
+  if (!blockcache_enabled()) {
+    NanThrowError("File system was not started with the blockCache option");
+    NanReturnUndefined();
+  }
+  blockcache_stats_t stats;
+  blockcache_stats(&stats);
+  Local<Object> result = NanNew<Object>();
+  result->Set(NanNew<String>("hits"), NanNew<Number>((double)stats.hits));
+  result->Set(NanNew<String>("misses"), NanNew<Number>((double)stats.misses));
+  result->Set(NanNew<String>("evictions"), NanNew<Number>((double)stats.evictions));
+  result->Set(NanNew<String>("blocks"), NanNew<Number>((double)stats.blocks));
+  result->Set(NanNew<String>("bytes"), NanNew<Number>((double)stats.bytes));
+  NanReturnValue(result);
+}
+
+// ---------------------------------------------------------------------------
+
 void init(Handle<Object> target)
 {
   target->Set(NanNew<String>("start"), NanNew<FunctionTemplate>(Start)->GetFunction());
+  target->Set(NanNew<String>("snapshot"), NanNew<FunctionTemplate>(Snapshot)->GetFunction());
+  target->Set(NanNew<String>("blockCacheStats"), NanNew<FunctionTemplate>(BlockCacheStats)->GetFunction());
 }
 
 // ---------------------------------------------------------------------------
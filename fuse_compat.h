@@ -0,0 +1,55 @@
+/*
+ *
+ * fuse_compat.h
+ *
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ *
+ */
+
+/*
+ * Selects the FUSE API to compile against. binding.gyp defines F4JS_FUSE3
+ * when libfuse 3 is installed; otherwise the FUSE 2.6 API is used, which is
+ * also what osxfuse provides.
+ */
+
+#ifndef FUSE_COMPAT_H
+#define FUSE_COMPAT_H
+
+#ifdef F4JS_FUSE3
+#define FUSE_USE_VERSION 31
+#else
+#define FUSE_USE_VERSION 26
+#endif
+
+#include <fuse.h>
+
+#ifdef F4JS_FUSE3
+
+// Names the adapter of an operation whose signature changed in libfuse 3
+#define F4JS_OP3(fn) fn##3
+
+#define F4JS_FILL_DIR(filler, buf, name, stbuf) \
+  (filler)((buf), (name), (stbuf), 0, (enum fuse_fill_dir_flags)0)
+
+#if FUSE_MAJOR_VERSION > 3 || FUSE_MINOR_VERSION >= 4
+#define F4JS_HAVE_COPY_FILE_RANGE
+#endif
+
+#define F4JS_HAVE_FALLOCATE
+
+#else
+
+#define F4JS_OP3(fn) fn
+
+#define F4JS_FILL_DIR(filler, buf, name, stbuf) \
+  (filler)((buf), (name), (stbuf), 0)
+
+#if FUSE_VERSION >= 29
+#define F4JS_HAVE_FALLOCATE
+#endif
+
+#endif
+
+#endif
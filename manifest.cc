@@ -0,0 +1,214 @@
+/*
+ *
+ * manifest.cc
+ *
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ *
+ */
+
+#include "manifest.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// ---------------------------------------------------------------------------
+
+static struct {
+  const char *base;      // NULL when no manifest is loaded
+  size_t size;
+  const manifest_header_t *header;
+  const manifest_entry_t *entries;
+  const uint32_t *children;
+  uint64_t childCount;   // number of slots in the children section
+  const char *strings;
+} manifest;
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Sections are validated when the manifest is opened; individual entries
+ * are checked as they are used, so that opening a large manifest does not
+ * have to touch all of it.
+ */
+static const char *manifest_string(uint64_t offset, uint32_t len)
+{
+  if (offset > manifest.header->stringsSize || len > manifest.header->stringsSize - offset)
+    return NULL;
+  return manifest.strings + offset;
+}
+
+// ---------------------------------------------------------------------------
+
+bool manifest_open(const char *file, std::string *error)
+{
+  manifest_close();
+
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    *error = std::string("cannot open manifest: ") + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(manifest_header_t)) {
+    close(fd);
+    *error = "manifest is truncated";
+    return false;
+  }
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    *error = std::string("cannot map manifest: ") + strerror(errno);
+    return false;
+  }
+
+  const manifest_header_t *header = (const manifest_header_t*)base;
+  uint64_t size = st.st_size;
+  uint64_t entriesSize = (uint64_t)header->entryCount * sizeof(manifest_entry_t);
+  if (memcmp(header->magic, MANIFEST_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != MANIFEST_VERSION) {
+    *error = "not a fuse4js manifest, or an unsupported version";
+  } else if (header->entriesOffset % 8 || header->childrenOffset % 4 ||
+             header->entriesOffset > size || entriesSize > size - header->entriesOffset ||
+             header->childrenOffset > header->stringsOffset ||
+             header->stringsOffset > size || header->stringsSize > size - header->stringsOffset) {
+    *error = "manifest is corrupt";
+  } else {
+    manifest.base = (const char*)base;
+    manifest.size = size;
+    manifest.header = header;
+    manifest.entries = (const manifest_entry_t*)(manifest.base + header->entriesOffset);
+    manifest.children = (const uint32_t*)(manifest.base + header->childrenOffset);
+    manifest.childCount = (header->stringsOffset - header->childrenOffset) / sizeof(uint32_t);
+    manifest.strings = manifest.base + header->stringsOffset;
+    return true;
+  }
+  munmap(base, st.st_size);
+  return false;
+}
+
+// ---------------------------------------------------------------------------
+
+void manifest_close()
+{
+  if (manifest.base)
+    munmap((void*)manifest.base, manifest.size);
+  manifest.base = NULL;
+}
+
+// ---------------------------------------------------------------------------
+
+bool manifest_loaded()
+{
+  return manifest.base != NULL;
+}
+
+// ---------------------------------------------------------------------------
+
+const manifest_entry_t *manifest_lookup(const char *path)
+{
+  if (manifest.base == NULL)
+    return NULL;
+  size_t pathLen = strlen(path);
+  uint32_t lo = 0, hi = manifest.header->entryCount;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const manifest_entry_t *entry = &manifest.entries[mid];
+    const char *name = manifest_string(entry->pathOffset, entry->pathLen);
+    if (name == NULL)
+      return NULL; // corrupt
+    int cmp = memcmp(name, path, std::min((size_t)entry->pathLen, pathLen));
+    if (cmp == 0)
+      cmp = (entry->pathLen < pathLen)? -1 : (entry->pathLen > pathLen)? 1 : 0;
+    if (cmp == 0)
+      return entry;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return NULL;
+}
+
+// ---------------------------------------------------------------------------
+
+static void manifest_time(double ms, struct timespec *out)
+{
+  double seconds = floor(ms / 1000.0);
+  out->tv_sec = (time_t)seconds;
+  out->tv_nsec = (long)((ms - seconds * 1000.0) * 1000000.0);
+}
+
+// ---------------------------------------------------------------------------
+
+void manifest_fill_stat(const manifest_entry_t *entry, struct stat *stbuf)
+{
+  memset(stbuf, 0, sizeof(*stbuf));
+  stbuf->st_mode = entry->mode;
+  stbuf->st_uid = entry->uid;
+  stbuf->st_gid = entry->gid;
+  stbuf->st_nlink = entry->nlink;
+  stbuf->st_size = entry->size;
+#ifdef __APPLE__
+  manifest_time(entry->mtime, &stbuf->st_mtimespec);
+  manifest_time(entry->ctime, &stbuf->st_ctimespec);
+  manifest_time(entry->atime, &stbuf->st_atimespec);
+#else
+  manifest_time(entry->mtime, &stbuf->st_mtim);
+  manifest_time(entry->ctime, &stbuf->st_ctim);
+  manifest_time(entry->atime, &stbuf->st_atim);
+#endif
+}
+
+// ---------------------------------------------------------------------------
+
+int manifest_readdir(const manifest_entry_t *entry, void *buf, fuse_fill_dir_t filler)
+{
+  if (!S_ISDIR(entry->mode))
+    return -ENOTDIR;
+  if (entry->childStart > manifest.childCount ||
+      entry->childCount > manifest.childCount - entry->childStart)
+    return -EIO;
+
+  F4JS_FILL_DIR(filler, buf, ".", NULL);
+  F4JS_FILL_DIR(filler, buf, "..", NULL);
+  std::string name;
+  for (uint32_t i = 0; i < entry->childCount; i++) {
+    uint32_t index = manifest.children[entry->childStart + i];
+    if (index >= manifest.header->entryCount)
+      return -EIO;
+    const manifest_entry_t *child = &manifest.entries[index];
+    const char *path = manifest_string(child->pathOffset, child->pathLen);
+    if (path == NULL)
+      return -EIO;
+    const char *start = path + child->pathLen;
+    while (start > path && start[-1] != '/')
+      start--;
+    name.assign(start, path + child->pathLen - start);
+    if (F4JS_FILL_DIR(filler, buf, name.c_str(), NULL))
+      break;
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+int manifest_readlink(const manifest_entry_t *entry, char *buf, size_t len)
+{
+  if (!S_ISLNK(entry->mode))
+    return -EINVAL;
+  const char *target = manifest_string(entry->linkOffset, entry->linkLen);
+  if (target == NULL || len == 0)
+    return -EIO;
+  size_t n = std::min((size_t)entry->linkLen, len - 1); // truncate like readlink()
+  memcpy(buf, target, n);
+  buf[n] = '\0';
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ *
+ * manifest.h
+ *
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ *
+ */
+
+/*
+ * Read-only metadata manifest. A manifest is a memory-mapped file holding
+ * the paths, stat fields, symbolic link targets and sorted directory
+ * listings of a tree, so that getattr(), readdir() and readlink() can be
+ * answered on the FUSE thread as soon as the file system is mounted.
+ * tools/mkmanifest.js builds one from a directory.
+ *
+ * Layout (little-endian, offsets from the start of the file):
+ *
+ *   header      manifest_header_t
+ *   entries     manifest_entry_t[entryCount], sorted by path bytes
+ *   children    uint32_t entry indexes; each directory owns a range,
+ *               sorted by name
+ *   strings     paths and link targets, not NUL terminated
+ */
+
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "fuse_compat.h"
+#include <stdint.h>
+#include <string>
+
+#define MANIFEST_MAGIC "F4JSMAN1"
+#define MANIFEST_VERSION 1
+
+struct manifest_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t entryCount;
+  uint64_t entriesOffset;
+  uint64_t childrenOffset;
+  uint64_t stringsOffset;
+  uint64_t stringsSize;
+  uint8_t reserved[16];
+};
+
+struct manifest_entry_t {
+  uint64_t pathOffset;   // relative to the strings section
+  uint32_t pathLen;
+  uint32_t mode;
+  uint32_t uid;
+  uint32_t gid;
+  uint32_t nlink;
+  uint32_t linkLen;      // symbolic links only
+  uint64_t size;
+  double mtime;          // milliseconds since the epoch, like a Javascript Date
+  double ctime;
+  double atime;
+  uint64_t linkOffset;   // relative to the strings section
+  uint32_t childStart;   // directories only, index into the children section
+  uint32_t childCount;
+};
+
+// Map a manifest file. Returns false and sets 'error' on failure.
+bool manifest_open(const char *file, std::string *error);
+void manifest_close();
+bool manifest_loaded();
+
+// Returns NULL if the path is not in the manifest
+const manifest_entry_t *manifest_lookup(const char *path);
+
+void manifest_fill_stat(const manifest_entry_t *entry, struct stat *stbuf);
+int manifest_readdir(const manifest_entry_t *entry, void *buf, fuse_fill_dir_t filler);
+int manifest_readlink(const manifest_entry_t *entry, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,780 @@
+/*
+ *
+ * memfs.cc
+ *
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ *
+ */
+
+#include "memfs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+// std::unordered_map needs C++11, except with libc++; gcc's C++98 mode has tr1
+#if __cplusplus >= 201103L || defined(_LIBCPP_VERSION)
+#include <unordered_map>
+#define MEMFS_HASH_MAP std::unordered_map
+#else
+#include <tr1/unordered_map>
+#define MEMFS_HASH_MAP std::tr1::unordered_map
+#endif
+
+// ---------------------------------------------------------------------------
+
+// File data is stored in extents of this size ...
+#define MEMFS_EXTENT_SIZE 65536
+// ... which are allocated this many at a time
+#define MEMFS_EXTENTS_PER_CHUNK 64
+#define MEMFS_CHUNK_SIZE ((size_t)MEMFS_EXTENT_SIZE * MEMFS_EXTENTS_PER_CHUNK)
+
+struct memfs_node_t;
+typedef MEMFS_HASH_MAP<std::string, memfs_node_t*> memfs_dir_t;
+
+// Extent number -> extent. Missing extents are holes, so sparse files
+// cost memory only for the data they hold.
+typedef std::map<size_t, char*> memfs_extents_t;
+
+struct memfs_node_t {
+  mode_t mode;
+  uid_t uid;
+  gid_t gid;
+  struct timespec atime;
+  struct timespec mtime;
+  struct timespec ctime;
+  off_t size;
+  memfs_extents_t extents;
+  memfs_dir_t children;
+  unsigned subdirs;            // number of child directories, for st_nlink
+  unsigned opens;              // open file handles
+  bool unlinked;               // removed from the tree while open
+};
+
+static struct {
+  memfs_node_t *root;
+  std::map<char*, unsigned> chunks; // arena chunk -> extents in use
+  std::set<char*> freeExtents;      // lowest first, so that chunks tend to empty
+  size_t usedExtents;
+} memfs;
+
+// Protects everything above. The FUSE thread and snapshot() both take it.
+static pthread_mutex_t memfs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+class MemfsLock {
+public:
+  MemfsLock() { pthread_mutex_lock(&memfs_mutex); }
+  ~MemfsLock() { pthread_mutex_unlock(&memfs_mutex); }
+};
+
+// ---------------------------------------------------------------------------
+
+static void memfs_now(struct timespec *ts)
+{
+  clock_gettime(CLOCK_REALTIME, ts);
+}
+
+// ---------------------------------------------------------------------------
+
+static std::map<char*, unsigned>::iterator memfs_chunk_of(char *extent)
+{
+  std::map<char*, unsigned>::iterator chunk = memfs.chunks.upper_bound(extent);
+  return --chunk;
+}
+
+// ---------------------------------------------------------------------------
+
+static char *memfs_extent_alloc()
+{
+  if (memfs.freeExtents.empty()) {
+    char *chunk = (char*)malloc(MEMFS_CHUNK_SIZE);
+    if (chunk == NULL)
+      return NULL;
+    memfs.chunks[chunk] = 0;
+    for (int i = 0; i < MEMFS_EXTENTS_PER_CHUNK; i++)
+      memfs.freeExtents.insert(chunk + (size_t)i * MEMFS_EXTENT_SIZE);
+  }
+  char *extent = *memfs.freeExtents.begin();
+  memfs.freeExtents.erase(memfs.freeExtents.begin());
+  memfs_chunk_of(extent)->second++;
+  memfs.usedExtents++;
+  memset(extent, 0, MEMFS_EXTENT_SIZE);
+  return extent;
+}
+
+// ---------------------------------------------------------------------------
+
+static void memfs_extent_free(char *extent)
+{
+  std::map<char*, unsigned>::iterator chunk = memfs_chunk_of(extent);
+  memfs.freeExtents.insert(extent);
+  memfs.usedExtents--;
+  if (--chunk->second == 0) {
+    // Give the memory back once the whole chunk is free
+    memfs.freeExtents.erase(memfs.freeExtents.lower_bound(chunk->first),
+                            memfs.freeExtents.lower_bound(chunk->first + MEMFS_CHUNK_SIZE));
+    free(chunk->first);
+    memfs.chunks.erase(chunk);
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+static memfs_node_t *memfs_node_new(mode_t mode)
+{
+  memfs_node_t *node = new memfs_node_t();
+  node->mode = mode;
+  node->uid = getuid();
+  node->gid = getgid();
+  memfs_now(&node->mtime);
+  node->atime = node->ctime = node->mtime;
+  node->size = 0;
+  node->subdirs = 0;
+  node->opens = 0;
+  node->unlinked = false;
+  return node;
+}
+
+// ---------------------------------------------------------------------------
+
+static void memfs_node_truncate(memfs_node_t *node, off_t size)
+{
+  size_t keep = (size + MEMFS_EXTENT_SIZE - 1) / MEMFS_EXTENT_SIZE;
+  memfs_extents_t::iterator it = node->extents.lower_bound(keep);
+  while (it != node->extents.end()) {
+    memfs_extent_free(it->second);
+    node->extents.erase(it++);
+  }
+
+  // Zero the cut-off part of the last extent, so that growing the file
+  // again exposes zeros rather than stale data
+  size_t tail = size % MEMFS_EXTENT_SIZE;
+  if (size < node->size && tail) {
+    it = node->extents.find(keep - 1);
+    if (it != node->extents.end())
+      memset(it->second + tail, 0, MEMFS_EXTENT_SIZE - tail);
+  }
+  node->size = size;
+}
+
+// ---------------------------------------------------------------------------
+
+static void memfs_node_free(memfs_node_t *node)
+{
+  for (memfs_dir_t::iterator it = node->children.begin(); it != node->children.end(); ++it)
+    memfs_node_free(it->second);
+  memfs_node_truncate(node, 0);
+  delete node;
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Dispose of a node that was just removed from the tree. The contents of
+ * an open file stay around until its last handle is released.
+ */
+static void memfs_node_unlinked(memfs_node_t *node)
+{
+  node->unlinked = true;
+  if (node->opens == 0)
+    memfs_node_free(node);
+}
+
+// ---------------------------------------------------------------------------
+
+static memfs_node_t *memfs_lookup(const char *path)
+{
+  memfs_node_t *node = memfs.root;
+  const char *p = path;
+  while (node) {
+    while (*p == '/')
+      p++;
+    if (*p == '\0')
+      return node;
+    if (!S_ISDIR(node->mode))
+      return NULL;
+    const char *end = strchr(p, '/');
+    if (end == NULL)
+      end = p + strlen(p);
+    memfs_dir_t::iterator it = node->children.find(std::string(p, end - p));
+    node = (it == node->children.end())? NULL : it->second;
+    p = end;
+  }
+  return NULL;
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ * Find the directory that holds 'path', and the last component of the path.
+ * Returns NULL for the root or when the parent does not exist.
+ */
+static memfs_node_t *memfs_lookup_parent(const char *path, std::string *name)
+{
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL || slash[1] == '\0')
+    return NULL;
+  *name = slash + 1;
+  memfs_node_t *parent = memfs_lookup(std::string(path, slash - path).c_str());
+  if (parent == NULL || !S_ISDIR(parent->mode))
+    return NULL;
+  return parent;
+}
+
+// ---------------------------------------------------------------------------
+
+static void memfs_touch(memfs_node_t *node)
+{
+  memfs_now(&node->mtime);
+  node->ctime = node->mtime;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_getattr(const char *path, struct stat *stbuf)
+{
+  MemfsLock lock;
+  memfs_node_t *node = memfs_lookup(path);
+  if (node == NULL)
+    return -ENOENT;
+
+  memset(stbuf, 0, sizeof(*stbuf));
+  stbuf->st_mode = node->mode;
+  stbuf->st_uid = node->uid;
+  stbuf->st_gid = node->gid;
+  stbuf->st_nlink = S_ISDIR(node->mode)? 2 + node->subdirs : 1;
+  stbuf->st_size = S_ISDIR(node->mode)? 4096 : node->size;
+  stbuf->st_blksize = MEMFS_EXTENT_SIZE;
+  stbuf->st_blocks = node->extents.size() * (MEMFS_EXTENT_SIZE / 512);
+#ifdef __APPLE__
+  stbuf->st_atimespec = node->atime;
+  stbuf->st_mtimespec = node->mtime;
+  stbuf->st_ctimespec = node->ctime;
+#else
+  stbuf->st_atim = node->atime;
+  stbuf->st_mtim = node->mtime;
+  stbuf->st_ctim = node->ctime;
+#endif
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi)
+{
+  MemfsLock lock;
+  memfs_node_t *node = memfs_lookup(path);
+  if (node == NULL)
+    return -ENOENT;
+  if (!S_ISDIR(node->mode))
+    return -ENOTDIR;
+
+  F4JS_FILL_DIR(filler, buf, ".", NULL);
+  F4JS_FILL_DIR(filler, buf, "..", NULL);
+  for (memfs_dir_t::iterator it = node->children.begin(); it != node->children.end(); ++it) {
+    if (F4JS_FILL_DIR(filler, buf, it->first.c_str(), NULL))
+      break;
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_readlink(const char *path, char *buf, size_t len)
+{
+  return -EINVAL; // the engine has no symbolic links
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_chmod(const char *path, mode_t mode)
+{
+  MemfsLock lock;
+  memfs_node_t *node = memfs_lookup(path);
+  if (node == NULL)
+    return -ENOENT;
+  node->mode = (node->mode & S_IFMT) | (mode & 07777);
+  memfs_now(&node->ctime);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_truncate(const char *path, off_t size)
+{
+  MemfsLock lock;
+  memfs_node_t *node = memfs_lookup(path);
+  if (node == NULL)
+    return -ENOENT;
+  if (S_ISDIR(node->mode))
+    return -EISDIR;
+  memfs_node_truncate(node, size);
+  memfs_touch(node);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_utimens(const char *path, const struct timespec tv[2])
+{
+  MemfsLock lock;
+  memfs_node_t *node = memfs_lookup(path);
+  if (node == NULL)
+    return -ENOENT;
+
+  struct timespec now;
+  memfs_now(&now);
+  struct timespec *times[2] = { &node->atime, &node->mtime };
+  for (int i = 0; i < 2; i++) {
+    if (tv == NULL || tv[i].tv_nsec == UTIME_NOW)
+      *times[i] = now;
+    else if (tv[i].tv_nsec != UTIME_OMIT)
+      *times[i] = tv[i];
+  }
+  node->ctime = now;
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_statfs(const char *path, struct statvfs *buf)
+{
+  MemfsLock lock;
+  // Report the physical memory as the capacity
+  unsigned long capacity = (unsigned long)
+    ((double)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE) / MEMFS_EXTENT_SIZE);
+  memset(buf, 0, sizeof(*buf));
+  buf->f_bsize = MEMFS_EXTENT_SIZE;
+  buf->f_frsize = MEMFS_EXTENT_SIZE;
+  buf->f_blocks = capacity;
+  buf->f_bfree = capacity > memfs.usedExtents? capacity - memfs.usedExtents : 0;
+  buf->f_bavail = buf->f_bfree;
+  buf->f_files = 1000000;
+  buf->f_ffree = 1000000;
+  buf->f_favail = 1000000;
+  buf->f_namemax = 255;
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_add(const char *path, mode_t mode, memfs_node_t **out)
+{
+  std::string name;
+  memfs_node_t *parent = memfs_lookup_parent(path, &name);
+  if (parent == NULL)
+    return -ENOENT;
+  if (parent->children.count(name))
+    return -EEXIST;
+  memfs_node_t *node = memfs_node_new(mode);
+  parent->children[name] = node;
+  if (S_ISDIR(mode))
+    parent->subdirs++;
+  memfs_touch(parent);
+  if (out)
+    *out = node;
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_mkdir(const char *path, mode_t mode)
+{
+  MemfsLock lock;
+  return memfs_add(path, S_IFDIR | (mode & 07777), NULL);
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_create(const char *path, mode_t mode, struct fuse_file_info *info)
+{
+  MemfsLock lock;
+  memfs_node_t *node;
+  int ret = memfs_add(path, S_IFREG | (mode & 07777), &node);
+  if (ret == 0) {
+    node->opens++;
+    info->fh = (uint64_t)(uintptr_t)node;
+  }
+  return ret;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_open(const char *path, struct fuse_file_info *info)
+{
+  MemfsLock lock;
+  memfs_node_t *node = memfs_lookup(path);
+  if (node == NULL)
+    return -ENOENT;
+  if (S_ISDIR(node->mode))
+    return -EISDIR;
+  node->opens++;
+  info->fh = (uint64_t)(uintptr_t)node; // reads and writes skip the path lookup
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_read(const char *path, char *buf, size_t len, off_t offset,
+                      struct fuse_file_info *info)
+{
+  MemfsLock lock;
+  memfs_node_t *node = (memfs_node_t*)(uintptr_t)info->fh;
+  if (offset >= node->size)
+    return 0;
+  if ((off_t)len > node->size - offset)
+    len = node->size - offset;
+
+  size_t done = 0;
+  while (done < len) {
+    off_t pos = offset + done;
+    size_t index = pos / MEMFS_EXTENT_SIZE;
+    size_t within = pos % MEMFS_EXTENT_SIZE;
+    size_t n = std::min(len - done, (size_t)MEMFS_EXTENT_SIZE - within);
+    memfs_extents_t::iterator it = node->extents.find(index);
+    if (it != node->extents.end())
+      memcpy(buf + done, it->second + within, n);
+    else
+      memset(buf + done, 0, n); // hole
+    done += n;
+  }
+  return len;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_node_write(memfs_node_t *node, const char *buf, size_t len, off_t offset)
+{
+  size_t done = 0;
+  while (done < len) {
+    off_t pos = offset + done;
+    size_t index = pos / MEMFS_EXTENT_SIZE;
+    size_t within = pos % MEMFS_EXTENT_SIZE;
+    size_t n = std::min(len - done, (size_t)MEMFS_EXTENT_SIZE - within);
+    memfs_extents_t::iterator it = node->extents.find(index);
+    if (it == node->extents.end()) {
+      char *extent = memfs_extent_alloc();
+      if (extent == NULL)
+        break;
+      it = node->extents.insert(std::make_pair(index, extent)).first;
+    }
+    memcpy(it->second + within, buf + done, n);
+    done += n;
+  }
+
+  if (offset + (off_t)done > node->size)
+    node->size = offset + done;
+  memfs_touch(node);
+  return done? (int)done : -ENOSPC;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_write(const char *path, const char *buf, size_t len, off_t offset,
+                       struct fuse_file_info *info)
+{
+  MemfsLock lock;
+  memfs_node_t *node = (memfs_node_t*)(uintptr_t)info->fh;
+  return memfs_node_write(node, buf, len, offset);
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_release(const char *path, struct fuse_file_info *info)
+{
+  MemfsLock lock;
+  memfs_node_t *node = (memfs_node_t*)(uintptr_t)info->fh;
+  if (--node->opens == 0 && node->unlinked)
+    memfs_node_free(node);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_unlink(const char *path)
+{
+  MemfsLock lock;
+  std::string name;
+  memfs_node_t *parent = memfs_lookup_parent(path, &name);
+  if (parent == NULL)
+    return -ENOENT;
+  memfs_dir_t::iterator it = parent->children.find(name);
+  if (it == parent->children.end())
+    return -ENOENT;
+  memfs_node_t *node = it->second;
+  if (S_ISDIR(node->mode))
+    return -EISDIR;
+  parent->children.erase(it);
+  memfs_touch(parent);
+  memfs_node_unlinked(node);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_rmdir(const char *path)
+{
+  MemfsLock lock;
+  std::string name;
+  memfs_node_t *parent = memfs_lookup_parent(path, &name);
+  if (parent == NULL)
+    return -ENOENT;
+  memfs_dir_t::iterator it = parent->children.find(name);
+  if (it == parent->children.end())
+    return -ENOENT;
+  memfs_node_t *node = it->second;
+  if (!S_ISDIR(node->mode))
+    return -ENOTDIR;
+  if (!node->children.empty())
+    return -ENOTEMPTY;
+  parent->children.erase(it);
+  parent->subdirs--;
+  memfs_touch(parent);
+  memfs_node_unlinked(node);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static int memfs_rename(const char *src, const char *dst)
+{
+  MemfsLock lock;
+  std::string srcName, dstName;
+  memfs_node_t *srcParent = memfs_lookup_parent(src, &srcName);
+  memfs_node_t *dstParent = memfs_lookup_parent(dst, &dstName);
+  if (srcParent == NULL || dstParent == NULL)
+    return -ENOENT;
+  memfs_dir_t::iterator it = srcParent->children.find(srcName);
+  if (it == srcParent->children.end())
+    return -ENOENT;
+  memfs_node_t *node = it->second;
+  bool isDir = S_ISDIR(node->mode);
+
+  // A directory cannot be moved below itself
+  size_t srcLen = strlen(src);
+  if (isDir && strncmp(dst, src, srcLen) == 0 && dst[srcLen] == '/')
+    return -EINVAL;
+
+  memfs_dir_t::iterator existing = dstParent->children.find(dstName);
+  if (existing != dstParent->children.end()) {
+    memfs_node_t *victim = existing->second;
+    if (victim == node)
+      return 0;
+    if (S_ISDIR(victim->mode)) {
+      if (!isDir)
+        return -EISDIR;
+      if (!victim->children.empty())
+        return -ENOTEMPTY;
+      dstParent->subdirs--;
+    } else if (isDir) {
+      return -ENOTDIR;
+    }
+    dstParent->children.erase(existing);
+    memfs_node_unlinked(victim);
+  }
+
+  srcParent->children.erase(srcName);
+  dstParent->children[dstName] = node;
+  if (isDir) {
+    srcParent->subdirs--;
+    dstParent->subdirs++;
+  }
+  memfs_touch(srcParent);
+  memfs_touch(dstParent);
+  memfs_now(&node->ctime);
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+#ifdef F4JS_FUSE3
+/*
+ * libfuse 3 added parameters to these operations. The engine looks nodes
+ * up by path and only supports plain renames.
+ */
+static int memfs_getattr3(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+  return memfs_getattr(path, stbuf);
+}
+
+static int memfs_readdir3(const char *path, void *buf, fuse_fill_dir_t filler,
+                          off_t offset, struct fuse_file_info *fi,
+                          enum fuse_readdir_flags flags)
+{
+  return memfs_readdir(path, buf, filler, offset, fi);
+}
+
+static int memfs_chmod3(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+  return memfs_chmod(path, mode);
+}
+
+static int memfs_truncate3(const char *path, off_t size, struct fuse_file_info *fi)
+{
+  return memfs_truncate(path, size);
+}
+
+static int memfs_utimens3(const char *path, const struct timespec tv[2], struct fuse_file_info *fi)
+{
+  return memfs_utimens(path, tv);
+}
+
+static int memfs_rename3(const char *src, const char *dst, unsigned int flags)
+{
+  if (flags)
+    return -EINVAL;
+  return memfs_rename(src, dst);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+
+void memfs_reset()
+{
+  MemfsLock lock;
+  if (memfs.root)
+    memfs_node_free(memfs.root);
+  for (std::map<char*, unsigned>::iterator it = memfs.chunks.begin(); it != memfs.chunks.end(); ++it)
+    free(it->first);
+  memfs.chunks.clear();
+  memfs.freeExtents.clear();
+  memfs.usedExtents = 0;
+  memfs.root = memfs_node_new(S_IFDIR | 0777);
+}
+
+// ---------------------------------------------------------------------------
+
+void memfs_register_ops(struct fuse_operations *ops)
+{
+  ops->getattr = F4JS_OP3(memfs_getattr);
+  ops->readdir = F4JS_OP3(memfs_readdir);
+  ops->readlink = memfs_readlink;
+  ops->chmod = F4JS_OP3(memfs_chmod);
+  ops->truncate = F4JS_OP3(memfs_truncate);
+  ops->utimens = F4JS_OP3(memfs_utimens);
+  ops->statfs = memfs_statfs;
+  ops->mkdir = memfs_mkdir;
+  ops->create = memfs_create;
+  ops->open = memfs_open;
+  ops->read = memfs_read;
+  ops->write = memfs_write;
+  ops->release = memfs_release;
+  ops->unlink = memfs_unlink;
+  ops->rmdir = memfs_rmdir;
+  ops->rename = F4JS_OP3(memfs_rename);
+}
+
+// ---------------------------------------------------------------------------
+
+int memfs_import_dir(const char *path)
+{
+  MemfsLock lock;
+  return memfs_add(path, S_IFDIR | 0777, NULL);
+}
+
+// ---------------------------------------------------------------------------
+
+int memfs_import_file(const char *path, const char *data, size_t len)
+{
+  MemfsLock lock;
+  memfs_node_t *node;
+  int ret = memfs_add(path, S_IFREG | 0666, &node);
+  if (ret)
+    return ret;
+
+  size_t done = 0;
+  while (done < len) {
+    ret = memfs_node_write(node, data + done, len - done, done);
+    if (ret < 0)
+      return ret;
+    done += ret;
+  }
+  return 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static void memfs_json_string(std::string &out, const char *data, size_t len)
+{
+  out += '"';
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = data[i];
+    switch (c) {
+    case '"':  out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    default:
+      if (c < 0x20) {
+        char esc[8];
+        snprintf(esc, sizeof(esc), "\\u%04x", c);
+        out += esc;
+      } else {
+        out += c; // file contents are treated as UTF-8 text, like jsonFS
+      }
+      break;
+    }
+  }
+  out += '"';
+}
+
+// ---------------------------------------------------------------------------
+
+static void memfs_json_node(std::string &out, memfs_node_t *node, int depth)
+{
+  if (!S_ISDIR(node->mode)) {
+    std::string data(node->size, '\0');
+    for (memfs_extents_t::iterator it = node->extents.begin(); it != node->extents.end(); ++it) {
+      size_t start = it->first * MEMFS_EXTENT_SIZE;
+      if (start < data.size())
+        memcpy(&data[start], it->second, std::min((size_t)MEMFS_EXTENT_SIZE, data.size() - start));
+    }
+    memfs_json_string(out, data.data(), data.size());
+    return;
+  }
+
+  // Sort the entries so that snapshots of the same tree are identical
+  std::vector<std::pair<std::string, memfs_node_t*> > entries(node->children.begin(),
+                                                               node->children.end());
+  std::sort(entries.begin(), entries.end());
+
+  if (entries.empty()) {
+    out += "{}";
+    return;
+  }
+  std::string indent(2 * (depth + 1), ' ');
+  out += "{\n";
+  for (size_t i = 0; i < entries.size(); i++) {
+    out += indent;
+    memfs_json_string(out, entries[i].first.data(), entries[i].first.size());
+    out += ": ";
+    memfs_json_node(out, entries[i].second, depth + 1);
+    out += (i + 1 < entries.size())? ",\n" : "\n";
+  }
+  out += std::string(2 * depth, ' ');
+  out += '}';
+}
+
+// ---------------------------------------------------------------------------
+
+std::string memfs_snapshot()
+{
+  MemfsLock lock;
+  std::string out;
+  if (memfs.root)
+    memfs_json_node(out, memfs.root, 0);
+  return out;
+}
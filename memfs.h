@@ -0,0 +1,42 @@
+/*
+ *
+ * memfs.h
+ *
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ *
+ */
+
+/*
+ * Native in-memory file system engine. When a file system is started with
+ * the inMemory option, operations without a Javascript handler are served
+ * on the FUSE thread by this engine, without any round trip to Javascript.
+ *
+ * Directories are hash tables of their entries. File contents are stored in
+ * fixed-size extents carved out of large arena chunks, indexed sparsely so
+ * that holes cost nothing; a chunk is freed once none of its extents are in
+ * use. The tree can be exported as JSON in the same format as
+ * example/jsonFS.js uses.
+ */
+
+#ifndef MEMFS_H
+#define MEMFS_H
+
+#include "fuse_compat.h"
+#include <string>
+
+// Discard all contents, leaving an empty root directory
+void memfs_reset();
+
+// Point the data operations in 'ops' to the engine
+void memfs_register_ops(struct fuse_operations *ops);
+
+// Seed the tree before mounting. Return 0 or a negated errno value.
+int memfs_import_dir(const char *path);
+int memfs_import_file(const char *path, const char *data, size_t len);
+
+// Directories become objects and files become strings
+std::string memfs_snapshot();
+
+#endif
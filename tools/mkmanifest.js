@@ -0,0 +1,207 @@
+/*
+ *
+ * mkmanifest.js
+ *
+ * Copyright (c) 2012 - 2014 by VMware, Inc. All Rights Reserved.
+ * http://www.vmware.com
+ * Refer to LICENSE.txt for details of distribution and use.
+ *
+ */
+
+/*
+ * Builds a metadata manifest from a directory tree. Pass it to f4js.start()
+ * with the 'manifest' option to have getattr(), readdir() and readlink()
+ * answered natively. See manifest.h for the file layout.
+ */
+
+var fs = require('fs');
+var pth = require('path');
+
+var HEADER_SIZE = 64;
+var ENTRY_SIZE = 80;
+var MAGIC = 'F4JSMAN1';
+var VERSION = 1;
+
+//---------------------------------------------------------------------------
+
+function writeUInt64(buf, value, offset) {
+  buf.writeUInt32LE(value % 0x100000000, offset);
+  buf.writeUInt32LE(Math.floor(value / 0x100000000), offset + 4);
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Byte-wise comparison, matching the memcmp() based lookup in the add-on.
+ */
+function compareBuffers(a, b) {
+  var n = Math.min(a.length, b.length);
+  for (var i = 0; i < n; ++i) {
+    if (a[i] !== b[i])
+      return a[i] - b[i];
+  }
+  return a.length - b.length;
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Write all of buf at the current position of fd
+ */
+function writeAll(fd, buf) {
+  var done = 0;
+  while (done < buf.length)
+    done += fs.writeSync(fd, buf, done, buf.length - done, null);
+}
+
+//---------------------------------------------------------------------------
+
+/*
+ * Walk the tree under srcRoot, returning one entry per file system object.
+ * Paths are relative to srcRoot and start with '/', as FUSE presents them.
+ * Only the stat fields the manifest records are kept, so that large trees
+ * fit in memory.
+ */
+function scan(srcRoot) {
+  var entries = [];
+  entries.stringsSize = 0;
+
+  function visit(path) {
+    var fullPath = pth.join(srcRoot, path);
+    var stat = fs.lstatSync(fullPath);
+    var entry = {
+      path: new Buffer(path, 'utf8'),
+      mode: stat.mode,
+      uid: stat.uid,
+      gid: stat.gid,
+      nlink: stat.nlink,
+      size: stat.size,
+      mtime: stat.mtime.getTime(),
+      ctime: stat.ctime.getTime(),
+      atime: stat.atime.getTime(),
+      link: null,
+      children: null
+    };
+    entries.push(entry);
+    if (stat.isSymbolicLink()) {
+      entry.link = new Buffer(fs.readlinkSync(fullPath), 'utf8');
+      entries.stringsSize += entry.link.length;
+    } else if (stat.isDirectory()) {
+      entry.children = fs.readdirSync(fullPath).map(function (name) {
+        return visit(path === '/' ? '/' + name : path + '/' + name);
+      });
+    }
+    entries.stringsSize += entry.path.length;
+    return entry;
+  }
+
+  visit('/');
+  return entries;
+}
+
+//---------------------------------------------------------------------------
+
+function build(srcRoot, outFile) {
+  var entries = scan(srcRoot);
+  var count = entries.length;
+  var i;
+
+  entries.sort(function (a, b) { return compareBuffers(a.path, b.path); });
+  for (i = 0; i < count; ++i)
+    entries[i].index = i;
+
+  // Every entry but the root is the child of exactly one directory
+  var numChildren = count - 1;
+  var stringsSize = entries.stringsSize;
+  var entriesOffset = HEADER_SIZE;
+  var childrenOffset = entriesOffset + count * ENTRY_SIZE;
+  var stringsOffset = childrenOffset + numChildren * 4;
+
+  var header = new Buffer(HEADER_SIZE);
+  header.fill(0);
+  header.write(MAGIC, 0, 8, 'ascii');
+  header.writeUInt32LE(VERSION, 8);
+  header.writeUInt32LE(count, 12);
+  writeUInt64(header, entriesOffset, 16);
+  writeUInt64(header, childrenOffset, 24);
+  writeUInt64(header, stringsOffset, 32);
+  writeUInt64(header, stringsSize, 40);
+
+  // Fill in all sections in one pass. A directory sorts before everything
+  // below it, so an entry's path is no longer needed once it is copied.
+  var table = new Buffer(count * ENTRY_SIZE);
+  table.fill(0);
+  var children = new Buffer(numChildren * 4);
+  var strings = new Buffer(stringsSize);
+  var childStart = 0, stringsPos = 0;
+  for (i = 0; i < count; ++i) {
+    var entry = entries[i];
+    var off = i * ENTRY_SIZE;
+    var numEntryChildren = entry.children ? entry.children.length : 0;
+    if (entry.children) {
+      entry.children.sort(function (a, b) { return compareBuffers(a.path, b.path); });
+      entry.children.forEach(function (child, j) {
+        children.writeUInt32LE(child.index, (childStart + j) * 4);
+      });
+    }
+    writeUInt64(table, stringsPos, off);
+    table.writeUInt32LE(entry.path.length, off + 8);
+    stringsPos += entry.path.copy(strings, stringsPos);
+    table.writeUInt32LE(entry.mode, off + 12);
+    table.writeUInt32LE(entry.uid, off + 16);
+    table.writeUInt32LE(entry.gid, off + 20);
+    table.writeUInt32LE(entry.nlink, off + 24);
+    writeUInt64(table, entry.size, off + 32);
+    table.writeDoubleLE(entry.mtime, off + 40);
+    table.writeDoubleLE(entry.ctime, off + 48);
+    table.writeDoubleLE(entry.atime, off + 56);
+    if (entry.link) {
+      table.writeUInt32LE(entry.link.length, off + 28);
+      writeUInt64(table, stringsPos, off + 64);
+      stringsPos += entry.link.copy(strings, stringsPos);
+    }
+    table.writeUInt32LE(childStart, off + 72);
+    table.writeUInt32LE(numEntryChildren, off + 76);
+    childStart += numEntryChildren;
+    entries[i] = null;
+  }
+
+  var fd = fs.openSync(outFile, 'w');
+  try {
+    writeAll(fd, header);
+    writeAll(fd, table);
+    writeAll(fd, children);
+    writeAll(fd, strings);
+  } finally {
+    fs.closeSync(fd);
+  }
+  return count;
+}
+
+//---------------------------------------------------------------------------
+
+function usage() {
+  console.log();
+  console.log("Usage: node mkmanifest.js sourceDirectory manifestFile");
+  console.log();
+  console.log("Example:");
+  console.log("node tools/mkmanifest.js /usr/share /tmp/share.manifest");
+  console.log();
+}
+
+//---------------------------------------------------------------------------
+
+(function main() {
+  var args = process.argv;
+  if (args.length !== 4) {
+    usage();
+    return;
+  }
+  try {
+    var count = build(args[2], args[3]);
+    console.log("Wrote " + count + " entries to " + args[3]);
+  } catch (e) {
+    console.log("Exception when building manifest: " + e);
+    process.exit(1);
+  }
+})();